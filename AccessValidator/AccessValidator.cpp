@@ -1,13 +1,68 @@
-// AccessValidator.cpp : Defines the entry point for the console application.
+﻿// AccessValidator.cpp : Defines the entry point for the console application.
 //
+// Без параметров решается встроенный пример. С параметром --serve граф загружается из двоичного файла
+// (graph_file.h, см. graph_convert) и программа отвечает на запросы, по одному в строке (query_server.h):
+//   ./access_validator --serve graph.avg [--socket PATH] [--threads T] [--mode bfs|best|astar|components]
+//                      [--max-states N] [--deadline-ms T]
+// Запросы читаются из stdin, ответы пишутся в stdout; с --socket - через сокет Unix.
 
 #include <iostream>
 #include <limits>
 #include <cassert>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <string>
+#include <cstdlib>
+#include <memory>
 
 #include "AccessValidator.h"
+#include "graph_file.h"
+#include "query_server.h"
+#include "trace.h"
 
-int main() {
+static void printTrace(std::stack<Solver::UpdateInfo> trace) {
+	for (/* empty */; !trace.empty(); trace.pop())
+		std::cout << trace.top().vid << " " << trace.top().old << " ==> " << trace.top().newValue << std::endl;
+}
+
+static void usage() {
+	std::cerr << "Usage: access_validator [--serve GRAPH.avg [--socket PATH] [--threads T]\n"
+		<< "                        [--mode bfs|best|astar|components] [--max-states N] [--deadline-ms T]]" << std::endl;
+}
+
+// Загружает граф один раз и отвечает на запросы до конца ввода (или без конца, если задан сокет)
+static int serve(const std::string &graph_path, const std::string &socket_path, const ServerOptions &options) {
+	std::unique_ptr<Graph> g;
+	try {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		GraphFile file(graph_path);
+		g.reset(new Graph(file));
+		std::cerr << "Loaded " << g->vertices().size() << " vertices, " << g->edgesCount() << " edges in "
+			<< std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+	}
+	catch (const BadGraphFile &e) {
+		std::cerr << graph_path << ": " << e.reason << std::endl;
+		return 1;
+	}
+	QueryServer server(*g, options);
+	if (socket_path.empty()) {
+		std::ios::sync_with_stdio(false);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		size_t count = server.serve(std::cin, std::cout);
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cerr << count << " queries in " << elapsed << " s (" << (elapsed > 0 ? count / elapsed : 0)
+			<< " queries/s)" << std::endl;
+		return 0;
+	}
+	if (!server.serveSocket(socket_path)) {
+		std::cerr << "Unable to listen on " << socket_path << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+static int example() {
 	// Проверим, что допускается использование бесконечности.
 	// Если это не компилируется, то можно удалить три строчки, но не будет бесконечных пределов
 	static_assert(std::numeric_limits<float>::is_iec559, "IEEE 754 required");
@@ -41,12 +96,79 @@ int main() {
 	std::cerr << "Building graph..." << std::endl;
 	std::cerr << predicates[0];
 	Graph g(edges, values, predicates);
-	std::cerr << "Please, consider FIXING Vertex::computeEquivalenceClasses()!" << std::endl;
-	std::cout << g.vertices().at(2) << std::endl;
+	std::cout << g.vertex(2) << std::endl;
 
 	Solver s;
-	s.solver(g, 0);
+	// События перебора выводятся, только если трассировка включена при компиляции (make TRACE=...)
+	s.traceSink = [](const TraceEvent &e) { std::cerr << e << std::endl; };
+	// Параллельный перебор не изменяет граф; сравним время при разном числе потоков
+	double single_thread_time = 0;
+	for (unsigned threads = 1; threads <= std::max(1u, std::thread::hardware_concurrency()); threads *= 2) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool access = s.parallelSolver(g, 0, threads);
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (threads == 1)
+			single_thread_time = elapsed;
+		std::cout << "Threads: " << threads << ", access: " << (access ? "yes" : "no")
+			<< ", time: " << elapsed << " s, speedup: " << single_thread_time / elapsed << std::endl;
+	}
+
+	// Кратчайшая последовательность изменений
+	if (s.shortestSolver(g, 0)) {
+		std::cout << "Shortest witness, " << s.trace.size() << " changes (in reverse order):\n";
+		printTrace(s.trace);
+	}
+
+	// Все вершины за один обход
+	std::vector<VertexID> targets = { 0, 1, 2 };
+	std::vector<Solver::TargetResult> results;
+	std::cout << "Accessible targets: " << s.batchSolver(g, targets, results) << " of " << targets.size() << std::endl;
+	for (size_t k = 0; k < results.size(); k++)
+		std::cout << "\t" << results[k].target << ": " << (results[k].accessible ? "yes" : "no")
+			<< ", " << results[k].trace.size() << " changes" << std::endl;
+
+	if (s.solver(g, 0)) {
+		std::cout << "SUCCESS! Chages made are (in reverse order):\n\n";
+		printTrace(s.trace);
+	}
+	else
+		std::cout << "No access to " << 0 << "\n" << std::endl;
+	std::cout << "Statistics: ";
+	s.stats.writeJson(std::cout, g);
+	std::cout << std::endl;
 
 	return 0;
 }
 
+int main(int argc, char *argv[]) {
+	if (argc == 1)
+		return example();
+
+	std::string graph_path, socket_path;
+	ServerOptions options;
+	for (int k = 1; k < argc; k++) {
+		std::string arg = argv[k];
+		if (k + 1 >= argc) {
+			usage();
+			return 1;
+		}
+		std::string value = argv[++k];
+		if (arg == "--serve") graph_path = value;
+		else if (arg == "--socket") socket_path = value;
+		else if (arg == "--threads") options.threads = std::strtoul(value.c_str(), 0, 10);
+		else if (arg == "--mode") options.mode = value;
+		else if (arg == "--max-states") options.maxStates = std::strtoul(value.c_str(), 0, 10);
+		else if (arg == "--deadline-ms") options.deadlineMs = std::atof(value.c_str());
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (graph_path.empty() || (options.mode != "bfs" && options.mode != "best" && options.mode != "astar"
+			&& options.mode != "components")) {
+		usage();
+		return 1;
+	}
+	return serve(graph_path, socket_path, options);
+}
+
@@ -1,13 +1,19 @@
 ﻿#pragma once
 
 #include <map>
+#include <unordered_map>
 #include <vector>
-#include <bitset>
 #include <set>
 #include <stack>
 #include <algorithm>
 #include <iostream>
+#include <functional>
+#include <string>
+#include <utility>
+#include <chrono>
+#include <atomic>
 #include "predicate.h"
+#include "edgeset.h"
 
 // Ошибки
 class Error {};
@@ -17,6 +23,9 @@ class Inaccessible : public Error {};
 // Попытка повторного добавления ребра 
 class DuplicatedEdge : public Error {};
 
+// Ребра между заданными вершинами нет
+class NoSuchEdge : public Error {};
+
 //
 // Вершины
 //
@@ -24,10 +33,8 @@ class DuplicatedEdge : public Error {};
 typedef unsigned int VertexID;
 typedef double ValueType;
 
-// Битовые множества требуют указать размер в момент компиляции.
-// Эта константа задает максимально допустимое число ребер в графе.
-const int max_edges = 32;
-typedef std::bitset<max_edges> EdgesBitset;
+// Размер битовых множеств ребер равен числу ребер в графе и задается при его построении.
+typedef EdgeSet EdgesBitset;
 typedef typename ::EdgesBitset SatisfiedEdges;
 typedef typename ::SatisfiedEdges EquivalenceClass;
 
@@ -37,8 +44,8 @@ struct ValueClass {
 	SatisfiedEdges edges_bitset; // Какие входящие ребра становятся выполнимыми, если вершина имеет это значение
 	EdgesBitset unsatisfied_edges; // Какие входящие ребра становятся невыполнимыми, если вершина имеет это значение
 
-	ValueClass(const ValueType& v, SatisfiedEdges &se, EdgesBitset &unsatisfied)
-		: val(v), edges_bitset(se), unsatisfied_edges(unsatisfied)
+	ValueClass(const ValueType& v, SatisfiedEdges se, EdgesBitset unsatisfied)
+		: val(v), edges_bitset(std::move(se)), unsatisfied_edges(std::move(unsatisfied))
 	{}
 };
 
@@ -47,44 +54,205 @@ typedef std::vector<ValueClass> ValueClasses;
 class Graph;
 class Vertex;
 
+typedef unsigned int VertexIndex; // Порядковый номер вершины в графе (индекс в массивах Graph и GraphState)
+typedef unsigned int EdgeID; // Порядковый номер ребра в графе
+
+// Ребра хранятся в Graph в виде отдельных массивов (начало, конец, предикат).
+// Edge - собранное по номеру представление одного ребра.
 struct Edge {
-	Vertex *from;
-	Vertex *to;
+	VertexIndex from;
+	VertexIndex to;
 	const Predicate *p;
-	bool satisfied;
-	size_t seq; // Порядковый номер ребра в графе
+	EdgeID seq; // Порядковый номер ребра в графе
+};
+
+// Непрерывный участок массива смежности: номера ребер, входящих в вершину или исходящих из нее
+class Edges {
+	const EdgeID *begin_;
+	const EdgeID *end_;
+public:
+	typedef const EdgeID *const_iterator;
+	Edges(const EdgeID *begin, const EdgeID *end) : begin_(begin), end_(end) {}
+	const_iterator begin() const { return begin_; }
+	const_iterator end() const { return end_; }
+	size_t size() const { return end_ - begin_; }
+	bool empty() const { return begin_ == end_; }
+	EdgeID operator[](size_t k) const { return begin_[k]; }
+};
+
+// Списки смежности всех вершин в одном массиве. Список вершины v занимает edges_[begin_[v] .. begin_[v] + size_[v]),
+// за ним до begin_[v] + capacity_[v] может оставаться свободное место для добавления ребер.
+// Переполненный список переносится в конец массива с удвоенной емкостью; когда освобожденных
+// при переносе мест становится больше половины массива, он уплотняется.
+// Порядок ребер в списке не гарантируется.
+class Adjacency {
+	std::vector<EdgeID> begin_, size_, capacity_;
+	std::vector<EdgeID> edges_;
+	size_t unused_; // Места, освобожденные при переносе списков
+
+	void compact();
+public:
+	Adjacency() : unused_(0) {}
+
+	// Раскладывает номера ребер по вершинам keys (началам или концам ребер) подсчетом,
+	// в порядке возрастания номеров
+	void build(const std::vector<VertexIndex> &keys, size_t vertices_count);
+	// По готовому представлению CSR: список вершины v - edges[offsets[v] .. offsets[v + 1])
+	void assign(const EdgeID *offsets, const EdgeID *edges, size_t vertices_count);
+	// Плотное представление CSR
+	void exportCSR(std::vector<EdgeID> &offsets, std::vector<EdgeID> &edges) const;
+
+	Edges operator[](VertexIndex v) const {
+		const EdgeID *first = edges_.data() + begin_[v];
+		return Edges(first, first + size_[v]);
+	}
+	void addVertex() {
+		begin_.push_back(static_cast<EdgeID>(edges_.size()));
+		size_.push_back(0);
+		capacity_.push_back(0);
+	}
+	void insert(VertexIndex v, EdgeID e);
+	// Удаляет ребро из списка v, ставя на его место последнее ребро списка
+	void erase(VertexIndex v, EdgeID e) {
+		EdgeID *first = &edges_[begin_[v]];
+		*std::find(first, first + size_[v], e) = first[size_[v] - 1];
+		size_[v]--;
+	}
+	// Заменяет номер ребра в списке v (при перенумерации ребер)
+	void renumber(VertexIndex v, EdgeID old_id, EdgeID new_id) {
+		EdgeID *first = &edges_[begin_[v]];
+		*std::find(first, first + size_[v], old_id) = new_id;
+	}
 };
 
-typedef std::vector<Edge*> Edges;
+// Множество доступных вершин: битовая карта по порядковым номерам для проверки за O(1)
+// и плотный список номеров для перебора. Добавление и удаление выполняются за O(1),
+// порядок перебора зависит от истории изменений.
+class AccessibleSet {
+	std::vector<bool> member_; // Битовая карта
+	std::vector<VertexIndex> list_; // Доступные вершины
+	std::vector<VertexIndex> position_; // Позиция вершины в list_
+public:
+	typedef std::vector<VertexIndex>::const_iterator const_iterator;
+
+	void resize(size_t vertices_count) {
+		member_.resize(vertices_count, false);
+		position_.resize(vertices_count, 0);
+	}
+	bool contains(VertexIndex v) const { return member_[v]; }
+	void insert(VertexIndex v) {
+		if (member_[v])
+			return;
+		member_[v] = true;
+		position_[v] = static_cast<VertexIndex>(list_.size());
+		list_.push_back(v);
+	}
+	void erase(VertexIndex v) {
+		if (!member_[v])
+			return;
+		member_[v] = false;
+		VertexIndex last = list_.back();
+		list_[position_[v]] = last;
+		position_[last] = position_[v];
+		list_.pop_back();
+	}
+	size_t size() const { return list_.size(); }
+	bool empty() const { return list_.empty(); }
+	const_iterator begin() const { return list_.begin(); }
+	const_iterator end() const { return list_.end(); }
+};
+
+// Журнал отмены изменений состояния графа; записи ведутся после первого вызова Graph::checkpoint().
+// Для каждого изменения значения хранится прежнее значение и ребра, выполненность которых изменилась.
+// Доступность вершин восстанавливается по счетчикам невыполненных ребер при обратном переключении ребер.
+// После изменения структуры графа номера ребер в flipped_edges теряют смысл, поэтому записи, сделанные
+// до него, откатываются пересчетом выполненности входящих ребер вершины.
+struct UndoLog {
+	struct Record {
+		VertexIndex vertex;
+		ValueType old_value;
+		size_t flipped; // Сколько ребер из flipped_edges относится к этому изменению
+	};
+	bool enabled;
+	std::vector<Record> records;
+	std::vector<EdgeID> flipped_edges;
+	size_t reevaluate_end; // Записи [0, reevaluate_end) откатываются пересчетом, их ребер в flipped_edges нет
+
+	UndoLog() : enabled(false), reevaluate_end(0) {}
+};
+
+// Изменяемое состояние графа: значения вершин, выполненность ребер и доступность вершин.
+// Структура графа (ребра, предикаты, классы значений) сюда не входит, поэтому копия состояния
+// позволяет вести независимый перебор над одним и тем же графом.
+struct GraphState {
+	std::vector<ValueType> values; // Значения вершин по их порядковым номерам (Vertex::index())
+	EquivalenceClass satisfied; // Выполненные ребра
+	std::vector<unsigned int> unsatisfied_out; // Число невыполненных исходящих ребер вершины; доступна, если их нет
+	AccessibleSet accessible; // Доступные вершины (порядковые номера)
+	UndoLog undo; // Журнал для отката изменений
+	size_t version; // Сколько изменений структуры графа учтено (Graph::structureVersion())
+
+	GraphState() : version(0) {}
+};
+
+// Рабочие массивы для вычисления классов эквивалентности (Vertex::computeEquivalenceClasses).
+// Переиспользуются от вершины к вершине, чтобы построение графа не выделяло память на каждую вершину.
+struct ClassScratch {
+	// Граница интервала входящего предиката: на участке segment ребро edge начинает (+1) или перестает (-1) выполняться
+	struct Event {
+		size_t segment;
+		size_t edge;
+		int delta;
+		bool operator<(const Event &other) const { return segment < other.segment; }
+	};
+	std::vector<double> points;
+	std::vector<Event> events;
+	std::vector<int> cover;
+	std::vector<size_t> changed;
+	std::vector<EdgeSet::Word> current;
+	// Кандидаты в классы: множества входящих ребер подряд по wordsFor(in.size()) слов, значения и размеры
+	std::vector<EdgeSet::Word> patterns;
+	std::vector<double> samples;
+	std::vector<size_t> sizes, kept;
+	// Отбор максимальных кандидатов: участки, на которых появился каждый кандидат,
+	// участки выполнения входящих ребер, прямоугольники попарных совпадений и дерево максимумов
+	struct Range {
+		size_t edge, first, last;
+		bool operator<(const Range &other) const { return edge != other.edge ? edge < other.edge : first < other.first; }
+	};
+	struct Rectangle {
+		size_t x, y_first, y_end;
+		int64_t delta;
+		bool operator<(const Rectangle &other) const { return x < other.x; }
+	};
+	std::vector<size_t> sample_segments;
+	std::vector<Range> ranges;
+	std::vector<Rectangle> rectangles;
+	std::vector<int64_t> tree_max, tree_add;
+};
 
 class Vertex {
 	Graph *g_; // К какому графу относится
-	Edges in_; // Входящие ребра
-	Edges out_; // Исходящие ребра
-	ValueType val_; // Значение вершины
-	bool accessible_; // результат последнего вызова checkAccessibility
+	VertexIndex index_; // Порядковый номер вершины в графе; индекс в массивах GraphState
 
 	ValueClasses classes_;
 
-	// Добавление входящего в вершину ребра
-	Edge *addInEdge(Edge *e);
-	
-	inline bool checkAccessibility() const; // Проверяет, что все исходящие ребра выполнены
-	void changeAccessibility(bool new_value);
 public:
 	const VertexID id; // Номер, который использовался при инициализации вершины
 
-	Vertex(Graph *g, VertexID vertex_id, const ValueType &val)
-		: g_(g), id(vertex_id), val_(val), accessible_(false) {
+	Vertex(Graph *g, VertexID vertex_id, VertexIndex index)
+		: g_(g), index_(index), id(vertex_id) {
 	}
 	~Vertex();
 
-	void addOutEdge(Edge *edge);
-	ValueType value() const { return val_; }
+	VertexIndex index() const { return index_; }
+	inline bool checkAccessibility(const EquivalenceClass &satisfied) const; // Проверяет, что все исходящие ребра выполнены
+	inline ValueType value() const;
 	void setValue(const ValueType &val); // Изменяет значение вершины. Создает исключение Inaccessible, если значение нельзя изменять
-	const Edges& predecessors() const { return in_; }
-	const Edges& successors() const { return out_; }
-	void computeEquivalenceClasses(); // вызывать после того, как все in_, out_ ребра заполнены
+	inline Edges predecessors() const; // Входящие ребра
+	inline Edges successors() const; // Исходящие ребра
+	void computeEquivalenceClasses(); // вызывать после того, как все ребра графа заполнены
+	void computeEquivalenceClasses(ClassScratch &scratch);
 	const ValueClasses &equivalenceClasses() const { return classes_; }
 
 	friend std::ostream& operator<<(std::ostream& os, const Vertex& v);
@@ -102,40 +270,194 @@ typedef struct {
 typedef typename std::set<VertexID> VertixIDSet;
 typedef typename std::map<VertexID, ValueType> VerticesValues;
 
+class GraphFile; // graph_file.h
+
+// Граф хранится в плоском виде: вершины пронумерованы подряд, ребра заданы массивами
+// начал, концов и номеров предикатов, списки смежности исходящих и входящих ребер - в массивах Adjacency.
+//
+// Граф можно изменять после построения (addEdge, removeEdge, replacePredicate). Номера ребер остаются плотными:
+// при удалении ребра его номер получает последнее ребро. Классы эквивалентности пересчитываются только
+// у конца измененного ребра; битовые множества классов остальных вершин сохраняют прежний размер
+// (см. EdgeSet о множествах разного размера). Изменения записываются, и копии состояния, сделанные
+// до них, приводятся к новой структуре повторением записей (update).
 class Graph {
 private:
 	friend class Vertex;
-	typedef typename std::map<VertexID, Vertex> VerticesMap;
-	VerticesMap vertices_;
-	Edges edges_;
-	std::set<VertexID> accessibleVertices_; // Вершины, которые доступны в настощий момент; изменяется после вызова setValue()
-	EquivalenceClass currentClass_;
+	typedef std::vector<Vertex> VerticesArray;
+	VerticesArray vertices_; // По порядковым номерам
+	std::unordered_map<VertexID, VertexIndex> indices_; // VertexID -> порядковый номер
+	std::vector<Predicate> predicates_; // Копия предикатов, на которые ссылаются ребра
+	std::vector<unsigned int> predicate_uses_; // Сколько ребер ссылается на предикат; 0 - место свободно
+	std::vector<unsigned int> free_predicates_;
+	std::vector<VertexIndex> edge_from_; // Начала ребер
+	std::vector<VertexIndex> edge_to_; // Концы ребер
+	std::vector<unsigned int> edge_predicate_; // Номера предикатов ребер
+	std::vector<PredicateKernel> edge_kernel_; // Проверка предикатов ребер; общий случай ссылается на predicates_
+	Adjacency out_; // Исходящие ребра
+	Adjacency in_; // Входящие ребра
+	GraphState state_; // Текущее состояние; изменяется после вызова setValue()
+	uint64_t fingerprint_; // Хеш структуры графа: вершин, ребер и предикатов
+	double build_seconds_; // Построение без вычисления классов эквивалентности
+	double classes_seconds_; // Вычисление классов, включая пересчет после изменений структуры
+
+	// Изменение структуры графа; номер версии структуры - число записей в changes_
+	struct StructureChange {
+		enum Kind { ADD_VERTEX, ADD_EDGE, REMOVE_EDGE, REPLACE_PREDICATE } kind;
+		EdgeID edge; // Добавленное, удаленное (его номер получает последнее ребро) или измененное ребро
+		VertexIndex vertex; // Новая вершина или начало добавленного или удаленного ребра
+		ValueType value; // Начальное значение новой вершины
+	};
+	std::vector<StructureChange> changes_;
 
 	Graph() {} // Приватный конструктор запрещает создавать неинициализированные объекты
+	Graph(const Graph&); // Вершины ссылаются на граф; копируется только состояние (state())
+
+	VertexIndex addVertex(VertexID vid, const ValueType &val); // Создает вершину (или находит по номеру)
+	void buildAdjacency(); // Заполняет массивы смежности по массивам начал и концов ребер
+	void checkDuplicatedEdges() const; // Повторное ребро между теми же вершинами - DuplicatedEdge
+	void flipEdge(GraphState &state, EdgeID e) const; // Меняет выполненность ребра и доступность его начала
+	// Изменение значения без проверки доступности; записывается в журнал отмены, если он включен
+	ValueType assignValue(GraphState &state, VertexIndex v, const ValueType &val) const;
+	void initState(); // Вычисляет выполненность ребер и доступность вершин по значениям state_.values
+	void computeFingerprint();
+	uint64_t edgeHash(EdgeID e) const; // Вклад ребра в отпечаток графа
+	void countPredicateUses();
+	void buildKernels(); // Заполняет edge_kernel_ по edge_predicate_
+	unsigned int storePredicate(const Predicate &p); // Занимает свободное место или добавляет предикат
+	void releasePredicate(unsigned int p);
+	EdgeID findEdge(VertexID from, VertexID to) const; // Бросает NoSuchEdge
+	void recomputeClasses(VertexIndex v); // После изменения входящих ребер вершины
+	void computeClasses(unsigned threads); // Классы эквивалентности всех вершин (при построении графа)
+	// Запоминает время построения (от start до classes_start) и классов (от classes_start до текущего момента)
+	// и добавляет его к счетчикам потока (threadStats())
+	void recordBuildTime(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point classes_start);
+	// Записывает изменение структуры; state_ уже изменено, его журнал отмены переводится на пересчет
+	void structureChanged(StructureChange::Kind kind, EdgeID edge, VertexIndex vertex, const ValueType &value = 0);
 
-	Vertex *addVertex(VertexID vid, const ValueType &val); // Создает вершину (или находит по номеру) в vertices_
+	friend void writeGraphFile(const Graph &g, const std::string &path, bool with_classes);
 
-	// Отмечает доступность или недоступность вершины в acessibleVertices_
-	void toggleVertexAccessibility(VertexID vid, bool accessibility);
 public:
-	Graph(const std::vector<edge_info>& edges, VerticesValues values, const std::vector<Predicate>& predicates);
+	// threads - число потоков для вычисления классов эквивалентности вершин (0 - по числу ядер);
+	// результат от него не зависит
+	Graph(const std::vector<edge_info>& edges, VerticesValues values, const std::vector<Predicate>& predicates,
+		unsigned threads = 0);
+	explicit Graph(const GraphFile &file, unsigned threads = 0); // Загрузка из двоичного файла (graph_file.h)
 	~Graph();
 
 	ValueType setValue(VertexID v, const ValueType &val); // Установить значение вершины
-	const Edges& predecessors(VertexID vid) const { return vertices_.at(vid).predecessors(); }
-	const Edges& successors(VertexID vid) const { return vertices_.at(vid).successors(); }
 
-	const VerticesMap& vertices() const {
+	// Изменение структуры графа. Текущее состояние (state()) обновляется сразу. Копии GraphState, сделанные
+	// ранее, обновляются при следующем обращении через граф (setValue, overrideValue, checkpoint, rollback,
+	// перебор из состояния start) или вызовом update(). Отметки журнала отмены остаются действительными.
+	// Отсутствующие вершины создаются со значением value. Повторное ребро - DuplicatedEdge.
+	EdgeID addEdge(VertexID from, VertexID to, const Predicate &p, const ValueType &value = 0);
+	void removeEdge(VertexID from, VertexID to); // Последнее ребро получает номер удаленного
+	void replacePredicate(VertexID from, VertexID to, const Predicate &p);
+	// Установить значение вершины в отдельно хранимом состоянии; сам граф не изменяется
+	ValueType setValue(GraphState &state, VertexID v, const ValueType &val) const;
+	// Задать значение вершины в отдельно хранимом состоянии независимо от ее доступности: исходные данные
+	// перебора, а не его шаг. Отменяется rollback(), как и setValue().
+	ValueType overrideValue(GraphState &state, VertexID v, const ValueType &val) const;
+	// Приводит состояние, скопированное до изменений структуры, к текущей структуре за время, пропорциональное
+	// числу изменений: новые вершины получают начальные значения, ребра - текущие номера, выполненность
+	// добавленных и измененных ребер вычисляется по значениям state. Значения прежних вершин не меняются.
+	void update(GraphState &state) const;
+	size_t structureVersion() const { return changes_.size(); }
+
+	// Отметка в журнале отмены. Первый вызов включает запись журнала.
+	typedef size_t Checkpoint;
+	Checkpoint checkpoint() { return checkpoint(state_); }
+	Checkpoint checkpoint(GraphState &state) const;
+	// Отменяет изменения, сделанные после отметки, за время, пропорциональное их числу
+	void rollback(Checkpoint mark) { rollback(state_, mark); }
+	void rollback(GraphState &state, Checkpoint mark) const;
+	// Сохраняет сделанные изменения: очищает журнал и прекращает запись
+	void commit() { commit(state_); }
+	void commit(GraphState &state) const;
+	Edges predecessors(VertexID vid) const { return vertex(vid).predecessors(); }
+	Edges successors(VertexID vid) const { return vertex(vid).successors(); }
+
+	const VerticesArray& vertices() const {
 		return vertices_;
 	}
-	const Vertex& vertex(VertexID vid) const { return vertices_.at(vid); }
-	Vertex& vertex(VertexID vid) { return vertices_.at(vid); }
+	bool hasVertex(VertexID vid) const { return indices_.find(vid) != indices_.end(); }
+	const Vertex& vertex(VertexID vid) const { return vertices_[indices_.at(vid)]; }
+	Vertex& vertex(VertexID vid) { return vertices_[indices_.at(vid)]; }
+	const Vertex& vertexAt(VertexIndex index) const { return vertices_[index]; }
 
-	const std::set<VertexID>& accessibleVertices() const { return accessibleVertices_; }
-	const EquivalenceClass &equivalenceClass() const { return currentClass_; }
+	size_t edgesCount() const { return edge_from_.size(); }
+	Edge edge(EdgeID seq) const { return { edge_from_[seq], edge_to_[seq], &predicates_[edge_predicate_[seq]], seq }; }
+	VertexIndex edgeFrom(EdgeID seq) const { return edge_from_[seq]; }
+	VertexIndex edgeTo(EdgeID seq) const { return edge_to_[seq]; }
+	const Predicate& edgePredicate(EdgeID seq) const { return predicates_[edge_predicate_[seq]]; }
+	const PredicateKernel& edgeKernel(EdgeID seq) const { return edge_kernel_[seq]; }
+	Edges outEdges(VertexIndex v) const { return out_[v]; }
+	Edges inEdges(VertexIndex v) const { return in_[v]; }
+
+	const GraphState& state() const { return state_; }
+	const AccessibleSet& accessibleVertices() const { return state_.accessible; }
+	bool isAccessible(VertexID vid) const { return state_.accessible.contains(indices_.at(vid)); }
+	const EquivalenceClass &equivalenceClass() const { return state_.satisfied; }
+	// Одинаков у графов с одинаковыми вершинами, ребрами и предикатами; значения вершин не учитываются
+	uint64_t fingerprint() const { return fingerprint_; }
+	double buildSeconds() const { return build_seconds_; }
+	double classesSeconds() const { return classes_seconds_; }
 	friend std::ostream &operator<<(std::ostream &os, const Graph &g);
 };
 
+struct TraceEvent; // trace.h
+class SolverCache; // solver_cache.h
+struct Condensation; // search.h
+
+// Ограничения перебора; нулевые значения означают отсутствие ограничения.
+// Проверяются перед раскрытием каждого состояния, а раскрытие не прерывается: число состояний может быть
+// превышено на потомков одного состояния, а срок - на время раскрытия вместе с вызванным им ростом
+// множества просмотренных (перестроение хеш-таблицы). После остановки перебор освобождает просмотренные
+// состояния за время, пропорциональное их числу, поэтому возврат из долгого перебора в ширину запаздывает
+// относительно срока на величину, растущую с размером перебора, а не на один шаг.
+struct SolverOptions {
+	std::chrono::steady_clock::time_point deadline; // Момент, после которого перебор прекращается
+	size_t maxStates; // Наибольшее число полученных состояний (statesExpanded)
+	size_t maxHistoryBytes; // Наибольший объем множества просмотренных состояний (приблизительно)
+	const std::atomic<bool> *cancel; // Флаг отмены, выставляемый из другого потока
+	// Если не 0, solver() хранит просмотренные состояния приближенно в битовом массиве этого размера
+	// (bitstate, см. state_store.h): память ограничена, но отсутствие доступа не доказывается (UNKNOWN)
+	size_t bitstateBytes;
+
+	SolverOptions() : maxStates(0), maxHistoryBytes(0), cancel(0), bitstateBytes(0) {}
+};
+
+// Статистика перебора и построения графа.
+// Счетчики увеличиваются на частых путях (Graph::setValue, цикл перебора), поэтому собираются без
+// синхронизации в структуре текущего потока (threadStats()). Перебор на время работы подменяет ее пустой,
+// а по завершении записывает собранное в Solver::stats и добавляет к прежним счетчикам потока.
+// Время построения графа и вычисления классов в Solver::stats - графа, на котором выполнен перебор
+// (Graph::buildSeconds(), Graph::classesSeconds()); к счетчикам потока оно добавляется при построении.
+struct SolverStats {
+	size_t statesExpanded; // Получено новых состояний
+	size_t duplicateStates; // Полученные состояния, которые уже были в множестве просмотренных
+	size_t maxDepth; // Наибольшая глубина перебора (число изменений от исходного состояния)
+	size_t setValueCalls; // Вызовы Graph::setValue
+	size_t historyPeakBytes; // Наибольший объем множества просмотренных состояний
+	double buildSeconds; // Построение графа без вычисления классов эквивалентности
+	double classesSeconds; // Вычисление классов эквивалентности
+	double searchSeconds; // Перебор
+	std::vector<size_t> branching; // По порядковым номерам вершин: сколько новых состояний дало изменение вершины
+
+	SolverStats() { clear(); }
+	void clear();
+	void countBranch(VertexIndex v) {
+		if (v >= branching.size())
+			branching.resize(v + 1, 0);
+		branching[v]++;
+	}
+	SolverStats& operator+=(const SolverStats &other); // Сумма; для наибольших значений - максимум
+	// Объект JSON. Ветвление выводится по номерам вершин графа g в порядке убывания, нулевое - не выводится.
+	void writeJson(std::ostream &os, const Graph &g) const;
+};
+
+SolverStats& threadStats(); // Счетчики текущего потока
+
 class Solver {
 public:
 	struct UpdateInfo {
@@ -144,16 +466,84 @@ public:
 		ValueType newValue;
 	};
 	std::stack<UpdateInfo> trace; // История выполненных изменений значений вершин
+	// Приемник событий перебора; вызывается, только если трассировка включена при компиляции (trace.h)
+	std::function<void(const TraceEvent&)> traceSink;
+	size_t statesExpanded; // Сколько новых классов эквивалентности получено в последнем переборе
+	// Кэш результатов, общий для нескольких переборов (необязательный). Используется в solver() и batchSolver().
+	SolverCache *cache;
+	// Сокращение перебора в solver() множествами пропускаемых изменений (sleep sets): изменения значений
+	// несмежных вершин перестановочны, и из двух порядков их выполнения рассматривается один
+	bool partialOrderReduction;
+	SolverOptions options;
+
+	// Итог последнего перебора. При UNKNOWN перебор прерван ограничением из options или неполон (bitstateBytes),
+	// и метод возвращает false.
+	enum Outcome { ACCESSIBLE, INACCESSIBLE, UNKNOWN };
+	enum StopReason { NOT_STOPPED, DEADLINE, STATE_LIMIT, MEMORY_LIMIT, CANCELLED };
+	Outcome outcome;
+	StopReason stopReason;
+	size_t historyBytes; // Приблизительный объем множества просмотренных состояний в последнем переборе
+	double historyLoadFactor; // Заполненность таблицы просмотренных состояний в последнем вызове solver()
+	SolverStats stats; // Статистика последнего перебора
+
+	// Результат перебора для одной из нескольких целей
+	struct TargetResult {
+		VertexID target;
+		bool accessible;
+		bool unknown; // Перебор прерван ограничением раньше, чем получен доступ
+		std::stack<UpdateInfo> trace; // Кратчайшая последовательность изменений, открывающая доступ
+	};
+
+	Solver() : statesExpanded(0), cache(0), partialOrderReduction(true),
+		outcome(INACCESSIBLE), stopReason(NOT_STOPPED), historyBytes(0), historyLoadFactor(0) {}
 	bool solver(Graph &g, VertexID target); // проверяет наличие доступа к целевой вершине
+	// Параллельный перебор в threads потоках (0 - по числу ядер). Граф не изменяется.
+	bool parallelSolver(const Graph &g, VertexID target, unsigned threads = 0);
+	// Поиск в ширину: в trace записывается кратчайшая последовательность изменений. Граф не изменяется.
+	bool shortestSolver(const Graph &g, VertexID target);
+	// Перегрузки с параметром start ведут перебор из отдельно хранимого состояния графа вместо текущего;
+	// в trace прежние значения относятся к start. Последовательность повторяется на самом start
+	// под контрольной точкой (Graph::checkpoint) и откатывается, поэтому по возвращении start не изменен.
+	bool shortestSolver(const Graph &g, GraphState &start, VertexID target);
+	// Поиск по приоритету: первыми раскрываются состояния, в которых выполнено больше исходящих ребер цели
+	// и ребер близких к ней вершин. Жадный вариант (shortest = false) быстрее находит какую-нибудь
+	// последовательность изменений, A* (shortest = true) - кратчайшую. Граф не изменяется.
+	bool bestFirstSolver(const Graph &g, VertexID target, bool shortest = false);
+	bool bestFirstSolver(const Graph &g, GraphState &start, VertexID target, bool shortest = false);
+	// Перебор по компонентам сильной связности (search.h, Condensation): компоненты, от которых зависит цель,
+	// перебираются по отдельности, начиная с нижних; для вышележащих компонент известно, какие сочетания
+	// значений нижних достижимы. В trace записывается последовательность изменений (не обязательно кратчайшая).
+	// Граф не изменяется. Для графов с петлями выполняется shortestSolver().
+	bool componentSolver(const Graph &g, VertexID target);
+	bool componentSolver(const Graph &g, GraphState &start, VertexID target);
+	// condensation - computeCondensation(g), вычисленное заранее для серии запросов к неизменному графу
+	bool componentSolver(const Graph &g, GraphState &start, VertexID target, const Condensation &condensation);
+	// Поиск в ширину сразу для нескольких целей: один обход пространства классов эквивалентности,
+	// который останавливается, когда доступ получен ко всем целям. results[k] соответствует targets[k].
+	// Возвращает число доступных целей. Граф не изменяется.
+	size_t batchSolver(const Graph &g, const std::vector<VertexID> &targets, std::vector<TargetResult> &results);
 };
 
 //
 // Реализация inline-функций
 //
-bool Vertex::checkAccessibility() const {
-	for (Edges::const_iterator e = out_.begin(); e != out_.end(); e++) {
-		if (!(*e)->satisfied)
+Edges Vertex::predecessors() const {
+	return g_->inEdges(index_);
+}
+
+Edges Vertex::successors() const {
+	return g_->outEdges(index_);
+}
+
+bool Vertex::checkAccessibility(const EquivalenceClass &satisfied) const {
+	Edges out = successors();
+	for (Edges::const_iterator e = out.begin(); e != out.end(); e++) {
+		if (!satisfied[*e])
 			return false;
 	}
 	return true;
 }
+
+ValueType Vertex::value() const {
+	return g_->state_.values[index_];
+}
@@ -0,0 +1,414 @@
+﻿// benchmark.cpp : замеры времени построения графа, изменения значений и перебора
+// на синтетических графах. Результаты выводятся в формате JSON (одна строка на запуск).
+//
+// Пример: ./benchmark --shape random --vertices 40 --degree 2 --indegree powerlaw --intervals 4 --queries 50
+// Перебор экспоненциален по числу вершин, поэтому для random и chain разумны графы из десятков вершин.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <memory>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "AccessValidator.h"
+#include "graph_file.h"
+#include "solver_cache.h"
+
+// Параметры генерации графа и замеров
+struct BenchConfig {
+	std::string shape; // random - случайный граф, chain - цепочка, fanin - одна вершина с большой входящей степенью, layered - слои
+	size_t vertices;
+	double degree; // Среднее число исходящих ребер вершины (для random и layered)
+	std::string indegree; // Распределение входящих степеней: uniform или powerlaw (для random)
+	size_t intervals; // Наибольшее число интервалов в предикате
+	std::string mode; // dfs, bfs, best (жадный поиск по приоритету), astar, parallel, batch (все цели за один обход) или components (по компонентам)
+	unsigned threads; // Для parallel; 0 - по числу ядер
+	unsigned build_threads; // Потоки для вычисления классов эквивалентности при построении графа; 0 - по числу ядер
+	std::string reduction; // Для dfs: sleep - сокращение перебора перестановочных изменений, none - без него
+	size_t queries; // Число целевых вершин для перебора
+	size_t max_states; // Ограничение перебора одной цели числом состояний (0 - без ограничения)
+	double deadline_ms; // Ограничение перебора одной цели по времени (0 - без ограничения)
+	double bitstate_mb; // Для dfs: размер битового массива просмотренных состояний (0 - точное хранение)
+	size_t set_value_ops; // Число вызовов Graph::setValue
+	size_t update_ops; // Число изменений структуры графа (addEdge, removeEdge, replacePredicate)
+	unsigned seed;
+	std::string input; // Двоичный файл графа (graph_file.h) вместо генерации
+	std::string save; // Сохранить сгенерированный граф в двоичный файл
+	std::string cache; // Файл кэша результатов (solver_cache.h); загружается, если существует, и сохраняется после замеров
+
+	BenchConfig()
+		: shape("random"), vertices(40), degree(2.0), indegree("uniform"), intervals(2),
+		  mode("dfs"), threads(0), build_threads(0), reduction("sleep"), queries(20), max_states(0), deadline_ms(0), bitstate_mb(0), set_value_ops(100000), update_ops(1000), seed(20160501) {}
+};
+
+// Исходные данные для построения графа
+struct GraphInput {
+	std::vector<edge_info> edges;
+	VerticesValues values;
+	std::vector<Predicate> predicates;
+};
+
+static const double value_range = 100.0;
+
+static Predicate randomPredicate(std::mt19937 &rng, size_t max_intervals) {
+	std::uniform_real_distribution<double> point(0.0, value_range);
+	size_t count = 1 + rng() % max_intervals;
+	std::vector<Interval> intervals;
+	for (size_t k = 0; k < count; k++) {
+		double left = point(rng);
+		double length = point(rng) / (2.0 * count);
+		intervals.push_back({ left, left + length, Interval::BorderType(rng() % 4) });
+	}
+	return Predicate(intervals);
+}
+
+// Случайный граф; концы ребер выбираются равномерно или со степенным распределением
+static GraphInput randomGraph(const BenchConfig &cfg, std::mt19937 &rng) {
+	GraphInput input;
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	for (size_t v = 0; v < cfg.vertices; v++)
+		input.values[v] = unit(rng) * value_range;
+	size_t edges_count = static_cast<size_t>(cfg.degree * cfg.vertices);
+	std::set<std::pair<VertexID, VertexID> > used;
+	for (size_t attempts = 0; input.edges.size() < edges_count && attempts < 4 * edges_count; attempts++) {
+		VertexID from = rng() % cfg.vertices;
+		VertexID to = (cfg.indegree == "powerlaw")
+			? static_cast<VertexID>(cfg.vertices * std::pow(unit(rng), 3.0)) % cfg.vertices
+			: rng() % cfg.vertices;
+		if (from == to || !used.insert(std::make_pair(from, to)).second)
+			continue;
+		input.predicates.push_back(randomPredicate(rng, cfg.intervals));
+		input.edges.push_back({ from, to, static_cast<int>(input.predicates.size() - 1) });
+	}
+	return input;
+}
+
+// Цепочка 0 -> 1 -> ... -> n-1: доступ к вершине 0 требует изменить значения всех вершин по очереди,
+// начиная с последней. Дополнительные ребра назад увеличивают число вариантов перебора.
+static GraphInput chainGraph(const BenchConfig &cfg, std::mt19937 &rng) {
+	GraphInput input;
+	for (size_t v = 0; v < cfg.vertices; v++)
+		input.values[v] = value_range + 1; // Вне всех интервалов
+	for (size_t v = 0; v + 1 < cfg.vertices; v++) {
+		input.predicates.push_back(randomPredicate(rng, cfg.intervals));
+		input.edges.push_back({ static_cast<VertexID>(v), static_cast<VertexID>(v + 1), static_cast<int>(input.predicates.size() - 1) });
+		if (v > 0 && rng() % 2 == 0) {
+			input.predicates.push_back(randomPredicate(rng, cfg.intervals));
+			input.edges.push_back({ static_cast<VertexID>(v + 1), static_cast<VertexID>(rng() % v), static_cast<int>(input.predicates.size() - 1) });
+		}
+	}
+	return input;
+}
+
+// Все вершины ссылаются на вершину 0: вычисление классов эквивалентности для нее - основная нагрузка
+static GraphInput faninGraph(const BenchConfig &cfg, std::mt19937 &rng) {
+	GraphInput input;
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	for (size_t v = 0; v < cfg.vertices; v++)
+		input.values[v] = unit(rng) * value_range;
+	for (size_t v = 1; v < cfg.vertices; v++) {
+		input.predicates.push_back(randomPredicate(rng, cfg.intervals));
+		input.edges.push_back({ static_cast<VertexID>(v), 0, static_cast<int>(input.predicates.size() - 1) });
+	}
+	return input;
+}
+
+// Слои по sqrt(vertices) вершин; вершина слоя ссылается на degree случайных вершин следующего слоя
+// и изредка на вершину своего слоя, образуя небольшие компоненты сильной связности.
+// Вершина 0 - в верхнем слое, ее доступность зависит от всех нижних слоев.
+static GraphInput layeredGraph(const BenchConfig &cfg, std::mt19937 &rng) {
+	GraphInput input;
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	const size_t width = std::max<size_t>(1, static_cast<size_t>(std::sqrt(static_cast<double>(cfg.vertices))));
+	for (size_t v = 0; v < cfg.vertices; v++)
+		input.values[v] = unit(rng) * value_range;
+	std::set<std::pair<VertexID, VertexID> > used;
+	for (size_t v = 0; v < cfg.vertices; v++) {
+		const size_t layer_begin = v / width * width, next_begin = layer_begin + width;
+		std::vector<VertexID> ends;
+		for (size_t k = 0; next_begin < cfg.vertices && k < static_cast<size_t>(cfg.degree + 0.5); k++)
+			ends.push_back(static_cast<VertexID>(next_begin + rng() % std::min(width, cfg.vertices - next_begin)));
+		if (rng() % 8 == 0)
+			ends.push_back(static_cast<VertexID>(layer_begin + rng() % std::min(width, cfg.vertices - layer_begin)));
+		for (std::vector<VertexID>::const_iterator to = ends.begin(); to != ends.end(); to++) {
+			if (*to == v || !used.insert(std::make_pair(static_cast<VertexID>(v), *to)).second)
+				continue;
+			input.predicates.push_back(randomPredicate(rng, cfg.intervals));
+			input.edges.push_back({ static_cast<VertexID>(v), *to, static_cast<int>(input.predicates.size() - 1) });
+		}
+	}
+	return input;
+}
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Пиковый объем памяти процесса в килобайтах (0, если неизвестен)
+static long peakMemoryKB() {
+#ifndef _WIN32
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		return usage.ru_maxrss;
+#endif
+	return 0;
+}
+
+// Процентили в формате JSON-объекта; samples упорядочиваются
+static std::string percentiles(std::vector<double> &samples) {
+	std::ostringstream os;
+	if (samples.empty())
+		return "null";
+	std::sort(samples.begin(), samples.end());
+	const double levels[] = { 0.5, 0.9, 0.99 };
+	const char *names[] = { "p50", "p90", "p99" };
+	os << "{";
+	for (size_t k = 0; k < 3; k++)
+		os << "\"" << names[k] << "\": " << samples[static_cast<size_t>(levels[k] * (samples.size() - 1))] << ", ";
+	os << "\"max\": " << samples.back() << "}";
+	return os.str();
+}
+
+// Ограничения перебора одной цели; отсчет времени начинается при вызове
+static SolverOptions solverOptions(const BenchConfig &cfg) {
+	SolverOptions options;
+	options.maxStates = cfg.max_states;
+	options.bitstateBytes = static_cast<size_t>(cfg.bitstate_mb * 1024 * 1024);
+	if (cfg.deadline_ms > 0)
+		options.deadline = std::chrono::steady_clock::now()
+			+ std::chrono::microseconds(static_cast<long long>(cfg.deadline_ms * 1000));
+	return options;
+}
+
+static void usage() {
+	std::cerr << "Usage: benchmark [--shape random|chain|fanin|layered] [--vertices N] [--degree D]\n"
+		<< "                 [--indegree uniform|powerlaw] [--intervals K] [--mode dfs|bfs|best|astar|parallel|batch|components]\n"
+		<< "                 [--reduction sleep|none] [--threads T] [--build-threads T] [--queries Q]\n"
+		<< "                 [--max-states N] [--deadline-ms T] [--bitstate-mb M] [--setvalue-ops S] [--update-ops U] [--seed S] [--output FILE]\n"
+		<< "                 [--input GRAPH.avg] [--save GRAPH.avg] [--cache FILE]" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+	BenchConfig cfg;
+	std::string output;
+	for (int k = 1; k < argc; k++) {
+		std::string arg = argv[k];
+		if (k + 1 >= argc) {
+			usage();
+			return 1;
+		}
+		std::string value = argv[++k];
+		if (arg == "--shape") cfg.shape = value;
+		else if (arg == "--vertices") cfg.vertices = std::strtoul(value.c_str(), 0, 10);
+		else if (arg == "--degree") cfg.degree = std::atof(value.c_str());
+		else if (arg == "--indegree") cfg.indegree = value;
+		else if (arg == "--intervals") cfg.intervals = std::max<size_t>(1, std::strtoul(value.c_str(), 0, 10));
+		else if (arg == "--mode") cfg.mode = value;
+		else if (arg == "--reduction") cfg.reduction = value;
+		else if (arg == "--threads") cfg.threads = std::strtoul(value.c_str(), 0, 10);
+		else if (arg == "--build-threads") cfg.build_threads = std::strtoul(value.c_str(), 0, 10);
+		else if (arg == "--queries") cfg.queries = std::strtoul(value.c_str(), 0, 10);
+		else if (arg == "--max-states") cfg.max_states = std::strtoul(value.c_str(), 0, 10);
+		else if (arg == "--deadline-ms") cfg.deadline_ms = std::atof(value.c_str());
+		else if (arg == "--bitstate-mb") cfg.bitstate_mb = std::atof(value.c_str());
+		else if (arg == "--setvalue-ops") cfg.set_value_ops = std::strtoul(value.c_str(), 0, 10);
+		else if (arg == "--update-ops") cfg.update_ops = std::strtoul(value.c_str(), 0, 10);
+		else if (arg == "--seed") cfg.seed = std::strtoul(value.c_str(), 0, 10);
+		else if (arg == "--output") output = value;
+		else if (arg == "--input") cfg.input = value;
+		else if (arg == "--save") cfg.save = value;
+		else if (arg == "--cache") cfg.cache = value;
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (cfg.vertices < 2) {
+		usage();
+		return 1;
+	}
+
+	std::mt19937 rng(cfg.seed);
+	// Построение графа, включая вычисление классов эквивалентности, или загрузка из файла
+	std::unique_ptr<Graph> graph;
+	std::chrono::steady_clock::time_point start;
+	double build_time;
+	try {
+		if (cfg.input.empty()) {
+			GraphInput input = cfg.shape == "chain" ? chainGraph(cfg, rng)
+				: cfg.shape == "fanin" ? faninGraph(cfg, rng)
+				: cfg.shape == "layered" ? layeredGraph(cfg, rng)
+				: randomGraph(cfg, rng);
+			start = std::chrono::steady_clock::now();
+			graph.reset(new Graph(input.edges, input.values, input.predicates, cfg.build_threads));
+			build_time = seconds(start);
+		}
+		else {
+			cfg.shape = "file";
+			start = std::chrono::steady_clock::now();
+			GraphFile file(cfg.input);
+			graph.reset(new Graph(file, cfg.build_threads));
+			build_time = seconds(start);
+		}
+		if (!cfg.save.empty())
+			writeGraphFile(*graph, cfg.save);
+	}
+	catch (const BadGraphFile &e) {
+		std::cerr << e.reason << std::endl;
+		return 1;
+	}
+	Graph &g = *graph;
+	size_t classes_count = 0;
+	for (std::vector<Vertex>::const_iterator v = g.vertices().begin(); v != g.vertices().end(); v++)
+		classes_count += v->equivalenceClasses().size();
+
+	// Изменения значений доступных вершин в отдельной копии состояния
+	std::vector<double> set_value_latency;
+	set_value_latency.reserve(cfg.set_value_ops);
+	GraphState state = g.state();
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	start = std::chrono::steady_clock::now();
+	for (size_t k = 0; k < cfg.set_value_ops && !state.accessible.empty(); k++) {
+		AccessibleSet::const_iterator v = state.accessible.begin() + rng() % state.accessible.size();
+		VertexID vid = g.vertexAt(*v).id;
+		ValueType val = unit(rng) * value_range;
+		std::chrono::steady_clock::time_point op_start = std::chrono::steady_clock::now();
+		g.setValue(state, vid, val);
+		set_value_latency.push_back(seconds(op_start) * 1e9);
+	}
+	double set_value_time = seconds(start);
+	size_t set_value_calls = set_value_latency.size();
+
+	// Перебор для нескольких целевых вершин
+	std::vector<VertexID> targets;
+	for (size_t q = 0; q < cfg.queries && !g.vertices().empty(); q++) {
+		targets.push_back((cfg.shape == "chain" || cfg.shape == "fanin" || cfg.shape == "layered") && q == 0 ? 0
+			: g.vertexAt(static_cast<VertexIndex>(rng() % g.vertices().size())).id);
+	}
+	SolverCache cache;
+	if (!cfg.cache.empty() && std::ifstream(cfg.cache.c_str())) {
+		try {
+			cache.load(cfg.cache);
+		}
+		catch (const BadCacheFile &e) {
+			std::cerr << e.reason << std::endl;
+			return 1;
+		}
+	}
+	std::vector<double> query_latency; // В режиме batch - одно значение на весь набор целей
+	size_t expanded = 0, reachable = 0, unknown = 0;
+	size_t history_bytes = 0; // Наибольший объем множества просмотренных состояний по целям
+	double load_factor = 0;
+	start = std::chrono::steady_clock::now();
+	if (cfg.mode == "batch") {
+		Solver s;
+		s.cache = cfg.cache.empty() ? 0 : &cache;
+		std::vector<Solver::TargetResult> results;
+		s.options = solverOptions(cfg);
+		reachable = s.batchSolver(g, targets, results);
+		query_latency.push_back(seconds(start) * 1e3);
+		for (size_t k = 0; k < results.size(); k++)
+			unknown += results[k].unknown ? 1 : 0;
+		expanded = s.statesExpanded;
+		history_bytes = s.historyBytes;
+	}
+	for (size_t q = 0; q < targets.size() && cfg.mode != "batch"; q++) {
+		Solver s;
+		s.cache = cfg.cache.empty() ? 0 : &cache;
+		s.partialOrderReduction = cfg.reduction != "none";
+		s.options = solverOptions(cfg);
+		std::chrono::steady_clock::time_point query_start = std::chrono::steady_clock::now();
+		bool access;
+		if (cfg.mode == "bfs")
+			access = s.shortestSolver(g, targets[q]);
+		else if (cfg.mode == "best" || cfg.mode == "astar")
+			access = s.bestFirstSolver(g, targets[q], cfg.mode == "astar");
+		else if (cfg.mode == "parallel")
+			access = s.parallelSolver(g, targets[q], cfg.threads);
+		else if (cfg.mode == "components")
+			access = s.componentSolver(g, targets[q]);
+		else {
+			Graph::Checkpoint mark = g.checkpoint();
+			access = s.solver(g, targets[q]);
+			g.rollback(mark);
+		}
+		query_latency.push_back(seconds(query_start) * 1e3);
+		expanded += s.statesExpanded;
+		history_bytes = std::max(history_bytes, s.historyBytes);
+		load_factor = std::max(load_factor, s.historyLoadFactor);
+		reachable += access ? 1 : 0;
+		unknown += s.outcome == Solver::UNKNOWN ? 1 : 0;
+	}
+	double solve_time = seconds(start);
+	if (!cfg.cache.empty())
+		cache.save(cfg.cache);
+
+	// Изменения структуры графа между случайными вершинами; выполняются последними, так как меняют граф
+	std::vector<double> update_latency;
+	std::vector<VertexID> ids;
+	for (std::vector<Vertex>::const_iterator v = g.vertices().begin(); v != g.vertices().end(); v++)
+		ids.push_back(v->id);
+	for (size_t k = 0; k < cfg.update_ops && ids.size() > 1; k++) {
+		VertexID from = ids[rng() % ids.size()], to = ids[rng() % ids.size()];
+		if (from == to)
+			continue;
+		Predicate p = randomPredicate(rng, cfg.intervals);
+		std::chrono::steady_clock::time_point op_start = std::chrono::steady_clock::now();
+		try {
+			if (k % 3 == 0)
+				g.addEdge(from, to, p);
+			else if (k % 3 == 1)
+				g.removeEdge(from, to);
+			else
+				g.replacePredicate(from, to, p);
+		}
+		catch (const DuplicatedEdge&) {
+			continue;
+		}
+		catch (const NoSuchEdge&) {
+			continue;
+		}
+		update_latency.push_back(seconds(op_start) * 1e6);
+	}
+	size_t update_calls = update_latency.size();
+
+	std::ostringstream json;
+	json << "{\"shape\": \"" << cfg.shape << "\", \"vertices\": " << g.vertices().size()
+		<< ", \"edges\": " << g.edgesCount() << ", \"indegree\": \"" << cfg.indegree
+		<< "\", \"intervals\": " << cfg.intervals << ", \"seed\": " << cfg.seed
+		<< ", \"mode\": \"" << cfg.mode << "\", \"reduction\": \"" << cfg.reduction << "\""
+		<< ", \"build\": {\"threads\": " << cfg.build_threads << ", \"seconds\": " << build_time << ", \"value_classes\": " << classes_count << "}"
+		<< ", \"set_value\": {\"calls\": " << set_value_calls << ", \"seconds\": " << set_value_time
+		<< ", \"calls_per_second\": " << (set_value_time > 0 ? set_value_calls / set_value_time : 0)
+		<< ", \"latency_ns\": " << percentiles(set_value_latency) << "}"
+		<< ", \"solve\": {\"queries\": " << targets.size() << ", \"reachable\": " << reachable << ", \"unknown\": " << unknown
+		<< ", \"seconds\": " << solve_time << ", \"states_expanded\": " << expanded
+		<< ", \"states_per_second\": " << (solve_time > 0 ? expanded / solve_time : 0)
+		<< ", \"latency_ms\": " << percentiles(query_latency)
+		<< ", \"history\": {\"peak_bytes\": " << history_bytes << ", \"load_factor\": " << load_factor << "}"
+		<< ", \"cache\": {\"entries\": " << cache.size() << ", \"hits\": " << cache.hits() << ", \"misses\": " << cache.misses() << "}}"
+		<< ", \"update\": {\"calls\": " << update_calls << ", \"latency_us\": " << percentiles(update_latency) << "}"
+		<< ", \"peak_memory_kb\": " << peakMemoryKB() << ", \"stats\": ";
+	// Счетчики основного потока за все время работы, включая построение и потоки parallelSolver()
+	threadStats().writeJson(json, g);
+	json << "}";
+
+	if (output.empty())
+		std::cout << json.str() << std::endl;
+	else {
+		std::ofstream out(output.c_str(), std::ios::app);
+		out << json.str() << std::endl;
+	}
+	return 0;
+}
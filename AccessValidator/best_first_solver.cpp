@@ -0,0 +1,204 @@
+﻿#include <vector>
+#include <queue>
+#include <unordered_set>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include "AccessValidator.h"
+#include "search.h"
+#include "trace.h"
+
+// Расстояние от цели до вершин по исходящим ребрам (поиск в ширину); для невлияющих вершин - no_distance
+static const unsigned no_distance = static_cast<unsigned>(-1);
+
+static std::vector<unsigned> influenceDistances(const Graph &g, const Vertex &target) {
+	std::vector<unsigned> distance(g.vertices().size(), no_distance);
+	std::vector<VertexIndex> layer(1, target.index()), next;
+	distance[target.index()] = 0;
+	for (unsigned d = 1; !layer.empty(); d++) {
+		next.clear();
+		for (std::vector<VertexIndex>::const_iterator v = layer.begin(); v != layer.end(); v++) {
+			Edges out = g.outEdges(*v);
+			for (Edges::const_iterator e = out.begin(); e != out.end(); e++) {
+				VertexIndex to = g.edgeTo(*e);
+				if (distance[to] == no_distance) {
+					distance[to] = d;
+					next.push_back(to);
+				}
+			}
+		}
+		layer.swap(next);
+	}
+	return distance;
+}
+
+// Оценка состояния:
+// - unsatisfied - число невыполненных исходящих ребер цели. Каждое ребро ведет в свою вершину, и каждую из них
+//   нужно изменить хотя бы раз, поэтому это нижняя оценка числа оставшихся изменений (для A*);
+// - distance_score - сумма весов невыполненных влияющих ребер. Вес ребра убывает вдвое с каждым шагом
+//   его начала от цели: ребра цели важнее всего, а ребра дальних вершин лишь "приближают" к ним.
+struct Estimate {
+	size_t unsatisfied;
+	double distance_score;
+};
+
+// Запись очереди: состояние, число изменений от исходного и оценка
+struct Candidate {
+	size_t state;
+	size_t depth;
+	Estimate estimate;
+};
+
+// Порядок выбора из очереди. Жадный поиск берет состояние с наименьшей distance_score,
+// A* - с наименьшей суммой глубины и нижней оценки, при равенстве - с меньшей distance_score.
+// Окончательно порядок определяется номером состояния, чтобы результат не зависел от реализации очереди.
+struct CandidateOrder {
+	bool shortest;
+	// true, если a выбирается позже b
+	bool operator()(const Candidate &a, const Candidate &b) const {
+		if (shortest && a.depth + a.estimate.unsatisfied != b.depth + b.estimate.unsatisfied)
+			return a.depth + a.estimate.unsatisfied > b.depth + b.estimate.unsatisfied;
+		if (a.estimate.distance_score != b.estimate.distance_score)
+			return a.estimate.distance_score > b.estimate.distance_score;
+		return a.state > b.state;
+	}
+};
+
+bool Solver::bestFirstSolver(const Graph &g, VertexID target, bool shortest) {
+	GraphState start = g.state();
+	return bestFirstSolver(g, start, target, shortest);
+}
+
+bool Solver::bestFirstSolver(const Graph &g, GraphState &start, VertexID target, bool shortest) {
+	this->trace = std::stack<UpdateInfo>();
+	this->statesExpanded = 0;
+	this->historyBytes = 0;
+	this->stopReason = NOT_STOPPED;
+	this->outcome = INACCESSIBLE;
+	StatsScope stats_scope(*this, g);
+	SolverStats &counters = threadStats();
+	g.update(start); // Состояние могло быть скопировано до изменений структуры графа
+	if (!g.hasVertex(target))
+		return false;
+	const Vertex &target_vertex = g.vertex(target);
+	if (target_vertex.checkAccessibility(start.satisfied)) {
+		outcome = ACCESSIBLE;
+		return true;
+	}
+
+	const TargetInfluence influence = computeInfluence(g, target);
+	// Веса влияющих ребер по расстоянию от цели до их начала
+	const std::vector<unsigned> distance = influenceDistances(g, target_vertex);
+	std::vector<double> weight(g.edgesCount(), 0.0);
+	for (EdgeID e = 0; e < g.edgesCount(); e++) {
+		if (influence.edges.test(e))
+			weight[e] = std::ldexp(1.0, -static_cast<int>(std::min(distance[g.edgeFrom(e)], 1000u)));
+	}
+
+	std::vector<EquivalenceClass> states;
+	std::vector<ParentLink> parents;
+	std::function<size_t(size_t)> state_hash = [&states](size_t k) { return states[k].hash(); };
+	std::function<bool(size_t, size_t)> state_equal = [&states](size_t a, size_t b) { return states[a] == states[b]; };
+	typedef std::unordered_set<size_t, std::function<size_t(size_t)>, std::function<bool(size_t, size_t)> > StateSet;
+	StateSet classes_history(16, state_hash, state_equal);
+	std::vector<size_t> depth; // Длина лучшего известного пути до состояния
+
+	states.push_back(start.satisfied);
+	influence.restrict(states.back());
+	parents.push_back({ no_parent, 0, 0 });
+	depth.push_back(0);
+	classes_history.insert(0);
+	historyBytes = stateBytes(states[0]) + sizeof(ParentLink) + sizeof(size_t);
+	SearchBudget budget(options);
+
+	Estimate initial = { 0, 0.0 };
+	for (EdgeID e = 0; e < g.edgesCount(); e++) {
+		if (!influence.edges.test(e) || states[0].test(e))
+			continue;
+		initial.distance_score += weight[e];
+		if (g.edgeFrom(e) == target_vertex.index())
+			initial.unsatisfied++;
+	}
+	std::priority_queue<Candidate, std::vector<Candidate>, CandidateOrder> queue((CandidateOrder({ shortest })));
+	queue.push({ 0, 0, initial });
+
+	size_t found = no_parent;
+	while (!queue.empty() && found == no_parent) {
+		const Candidate head = queue.top();
+		queue.pop();
+		if (head.depth != depth[head.state])
+			continue; // Состояние уже поставлено в очередь с более коротким путем
+		stopReason = budget.check(states.size() - 1, historyBytes + queue.size() * sizeof(Candidate));
+		if (stopReason != NOT_STOPPED)
+			break;
+		// A* проверяет цель при выборе состояния из очереди: только тогда найденный путь кратчайший
+		if (shortest && head.estimate.unsatisfied == 0 && target_vertex.checkAccessibility(states[head.state])) {
+			found = head.state;
+			break;
+		}
+		for (std::vector<Vertex>::const_iterator v = g.vertices().begin(); v != g.vertices().end() && found == no_parent; v++) {
+			const Vertex &vertex = *v;
+			if (!influence.relevant(vertex) || !vertex.checkAccessibility(states[head.state]))
+				continue;
+			const ValueClasses &equiv_classes = vertex.equivalenceClasses();
+			Edges in = vertex.predecessors();
+			for (size_t c = 0; c < equiv_classes.size(); c++) {
+				states.push_back(merge(states[head.state], equiv_classes[c].edges_bitset, equiv_classes[c].unsatisfied_edges));
+				influence.restrict(states.back());
+				size_t next = states.size() - 1;
+				std::pair<StateSet::iterator, bool> inserted = classes_history.insert(next);
+				if (!inserted.second) {
+					states.pop_back();
+					next = *inserted.first;
+					counters.duplicateStates++;
+					// A*: состояние уже получено более длинным путем - запоминаем новый путь и ставим его в очередь снова
+					if (!shortest || depth[next] <= head.depth + 1)
+						continue;
+					parents[next] = { head.state, vertex.id, c };
+					depth[next] = head.depth + 1;
+				}
+				else {
+					parents.push_back({ head.state, vertex.id, c });
+					depth.push_back(head.depth + 1);
+					historyBytes += stateBytes(states[next]) + sizeof(ParentLink) + sizeof(size_t);
+					counters.countBranch(vertex.index());
+					counters.maxDepth = std::max(counters.maxDepth, head.depth + 1);
+				}
+				if (!shortest && target_vertex.checkAccessibility(states[next])) {
+					found = next;
+					break;
+				}
+				// Изменение затрагивает только входящие ребра вершины: оценка пересчитывается по ним
+				const EquivalenceClass &before = states[head.state], &after = states[next];
+				Estimate estimate = head.estimate;
+				for (Edges::const_iterator e = in.begin(); e != in.end(); e++) {
+					if (before.test(*e) == after.test(*e) || !influence.edges.test(*e))
+						continue;
+					const bool fixed = after.test(*e);
+					if (fixed)
+						estimate.distance_score -= weight[*e];
+					else
+						estimate.distance_score += weight[*e];
+					if (g.edgeFrom(*e) == target_vertex.index()) {
+						if (fixed)
+							estimate.unsatisfied--;
+						else
+							estimate.unsatisfied++;
+					}
+				}
+				queue.push({ next, head.depth + 1, estimate });
+			}
+		}
+	}
+	statesExpanded = states.size() - 1;
+	if (found == no_parent) {
+		AV_TRACE_EVENT(*this, AV_TRACE_RESULT, TraceEvent::FAILURE, 0);
+		outcome = stopReason == NOT_STOPPED ? INACCESSIBLE : UNKNOWN;
+		return false;
+	}
+
+	replayWitness(*this, g, start, parents, found, trace);
+	AV_TRACE_EVENT(*this, AV_TRACE_RESULT, TraceEvent::SUCCESS, trace.size());
+	outcome = ACCESSIBLE;
+	return true;
+}
@@ -0,0 +1,391 @@
+﻿#include <vector>
+#include <unordered_set>
+#include <functional>
+#include <algorithm>
+#include <cassert>
+#include "AccessValidator.h"
+#include "search.h"
+#include "trace.h"
+
+Condensation computeCondensation(const Graph &g) {
+	// Алгоритм Тарьяна без рекурсии. Компонента выделяется, когда обойдены все вершины, достижимые из ее корня,
+	// поэтому компоненты, в которые ведут ребра, получают меньшие номера.
+	const size_t n = g.vertices().size();
+	const size_t unvisited = static_cast<size_t>(-1);
+	Condensation result;
+	result.component.assign(n, unvisited);
+	std::vector<size_t> order(n, unvisited), low(n, 0);
+	std::vector<VertexIndex> open; // Вершины еще не выделенных компонент
+	std::vector<std::pair<VertexIndex, size_t> > path; // Путь обхода в глубину: вершина и номер следующего ребра
+	size_t visited = 0;
+	for (VertexIndex root = 0; root < n; root++) {
+		if (order[root] != unvisited)
+			continue;
+		order[root] = low[root] = visited++;
+		open.push_back(root);
+		path.push_back(std::make_pair(root, 0));
+		while (!path.empty()) {
+			const VertexIndex v = path.back().first;
+			Edges out = g.outEdges(v);
+			if (path.back().second < out.size()) {
+				const VertexIndex to = g.edgeTo(out[path.back().second++]);
+				if (order[to] == unvisited) {
+					order[to] = low[to] = visited++;
+					open.push_back(to);
+					path.push_back(std::make_pair(to, 0));
+				}
+				else if (result.component[to] == unvisited)
+					low[v] = std::min(low[v], order[to]);
+				continue;
+			}
+			path.pop_back();
+			if (!path.empty())
+				low[path.back().first] = std::min(low[path.back().first], low[v]);
+			if (low[v] != order[v])
+				continue;
+			// v - корень компоненты; ее вершины лежат в open начиная с v
+			result.members.push_back(std::vector<VertexIndex>());
+			VertexIndex w;
+			do {
+				w = open.back();
+				open.pop_back();
+				result.component[w] = result.members.size() - 1;
+				result.members.back().push_back(w);
+			} while (w != v);
+		}
+	}
+	return result;
+}
+
+// Исходящие ребра вершины в одну из нижних компонент: для изменения вершины они должны быть выполнены одновременно
+struct Requirement {
+	size_t component;
+	std::vector<EdgeID> edges;
+};
+
+static bool satisfiedAll(const EquivalenceClass &state, const std::vector<EdgeID> &edges) {
+	for (std::vector<EdgeID>::const_iterator e = edges.begin(); e != edges.end(); e++)
+		if (!state.test(*e))
+			return false;
+	return true;
+}
+
+// Перебор по компонентам сильной связности.
+//
+// Изменение вершины затрагивает только входящие в нее ребра, а ее доступность определяется исходящими.
+// Поэтому при отсутствии петель вершину сразу после изменения можно изменить снова - вернуть прежний класс
+// значений или класс, содержащий выполненные ребра исходного значения. Доступность монотонна
+// по выполненным ребрам, и, отменяя изменения в обратном порядке, из любого достижимого состояния можно
+// получить состояние, не худшее любого другого достижимого. Значит, нижняя компонента может в любой момент
+// принять любое свое достижимое состояние независимо от вышележащих. Вышележащим компонентам достаточно
+// знать множество этих состояний, ограниченных на ребра, входящие в компоненту извне (интерфейс).
+//
+// Компоненты, влияющие на цель, перебираются в ширину по отдельности в порядке номеров (Condensation),
+// начиная с нижних. Вершина компоненты может изменяться, если выполнены ее ребра внутри компоненты
+// (проверяется по состоянию перебора) и для каждой нижней компоненты есть достижимое состояние,
+// в котором выполнены ее ребра в эту компоненту (проверяется один раз, movable_).
+class ComponentSearch {
+	const Graph &g_;
+	GraphState &start_; // Исходное состояние перебора; изменяется только в witness() и откатывается
+	const TargetInfluence &influence_;
+	const VertexIndex target_;
+	const Condensation &condensation_;
+	std::vector<EdgesBitset> mask_; // Влияющие ребра, входящие в вершины компоненты (состояние перебора)
+	std::vector<EdgesBitset> interface_; // Те из них, что исходят из вершин вне компоненты
+	std::vector<std::vector<EdgesBitset> > reachable_; // Максимальные по включению достижимые состояния интерфейса
+	std::vector<std::vector<Requirement> > requirements_; // По вершинам; компоненты по убыванию номеров
+	std::vector<bool> movable_;
+	std::vector<EdgeID> target_edges_; // Исходящие ребра цели внутри ее компоненты
+
+	SearchBudget *budget_; // Ограничения проверяются только при переборе, но не при построении последовательности
+	Solver::StopReason stop_;
+	size_t expanded_, retained_bytes_, bytes_, peak_bytes_;
+
+	size_t explore(size_t c, const EquivalenceClass &start, const std::vector<EdgeID> *goal,
+		std::vector<EquivalenceClass> &states, std::vector<ParentLink> &parents);
+	bool internalSatisfied(VertexIndex v, const EquivalenceClass &state) const;
+	bool feasible(const std::vector<Requirement> &requirements) const;
+	void collectReachable(size_t c, const std::vector<EquivalenceClass> &states);
+	void realize(GraphState &state, size_t c, const std::vector<EdgeID> &required,
+		const Solver &solver, std::stack<Solver::UpdateInfo> &trace);
+	void realizeRequirements(GraphState &state, VertexIndex v, const Solver &solver, std::stack<Solver::UpdateInfo> &trace);
+
+public:
+	ComponentSearch(const Graph &g, GraphState &start, const TargetInfluence &influence, VertexIndex target,
+		const Condensation &condensation);
+
+	Solver::Outcome solve(SearchBudget &budget);
+	// Записывает в trace изменения, открывающие доступ к цели; вызывается, если solve() вернул ACCESSIBLE
+	void witness(const Solver &solver, std::stack<Solver::UpdateInfo> &trace);
+
+	Solver::StopReason stopReason() const { return stop_; }
+	size_t statesExpanded() const { return expanded_; }
+	size_t historyBytes() const { return peak_bytes_; }
+};
+
+ComponentSearch::ComponentSearch(const Graph &g, GraphState &start, const TargetInfluence &influence,
+		VertexIndex target, const Condensation &condensation)
+	: g_(g), start_(start), influence_(influence), target_(target), condensation_(condensation),
+	  budget_(0), stop_(Solver::NOT_STOPPED), expanded_(0), retained_bytes_(0), bytes_(0), peak_bytes_(0) {
+	const size_t edges_count = g.edgesCount();
+	const size_t components = condensation_.members.size();
+	mask_.resize(components);
+	interface_.resize(components);
+	reachable_.resize(components);
+	requirements_.resize(g.vertices().size());
+	movable_.assign(g.vertices().size(), false);
+
+	for (VertexIndex v = 0; v < g.vertices().size(); v++) {
+		if (!influence.vertices[v] && v != target)
+			continue;
+		const size_t own = condensation_.component[v];
+		Edges out = g.outEdges(v);
+		for (Edges::const_iterator e = out.begin(); e != out.end(); e++) {
+			const VertexIndex to = g.edgeTo(*e);
+			const size_t c = condensation_.component[to];
+			if (mask_[c].size() == 0) {
+				mask_[c] = EdgesBitset(edges_count);
+				interface_[c] = EdgesBitset(edges_count);
+			}
+			mask_[c].set(*e);
+			if (c == own) {
+				if (v == target)
+					target_edges_.push_back(*e);
+				continue;
+			}
+			interface_[c].set(*e);
+			std::vector<Requirement> &r = requirements_[v];
+			std::vector<Requirement>::iterator same = std::find_if(r.begin(), r.end(),
+				[c](const Requirement &q) { return q.component == c; });
+			if (same == r.end())
+				same = r.insert(r.end(), Requirement({ c, std::vector<EdgeID>() }));
+			same->edges.push_back(*e);
+		}
+		// Нижние компоненты приводятся в нужное состояние начиная с вышележащих: изменения в компоненте
+		// не затрагивают компонент с большими номерами
+		std::sort(requirements_[v].begin(), requirements_[v].end(),
+			[](const Requirement &a, const Requirement &b) { return a.component > b.component; });
+	}
+	const size_t target_component = condensation_.component[target];
+	if (mask_[target_component].size() == 0)
+		mask_[target_component] = EdgesBitset(edges_count);
+}
+
+bool ComponentSearch::internalSatisfied(VertexIndex v, const EquivalenceClass &state) const {
+	const size_t own = condensation_.component[v];
+	Edges out = g_.outEdges(v);
+	for (Edges::const_iterator e = out.begin(); e != out.end(); e++)
+		if (condensation_.component[g_.edgeTo(*e)] == own && !state.test(*e))
+			return false;
+	return true;
+}
+
+bool ComponentSearch::feasible(const std::vector<Requirement> &requirements) const {
+	for (std::vector<Requirement>::const_iterator r = requirements.begin(); r != requirements.end(); r++) {
+		const std::vector<EdgesBitset> &reachable = reachable_[r->component];
+		bool found = false;
+		for (std::vector<EdgesBitset>::const_iterator s = reachable.begin(); s != reachable.end() && !found; s++)
+			found = satisfiedAll(*s, r->edges);
+		if (!found)
+			return false;
+	}
+	return true;
+}
+
+// Поиск в ширину по состояниям компоненты c от start до состояния, в котором выполнены ребра goal
+// (без goal - до исчерпания). Возвращает номер найденного состояния или no_parent.
+size_t ComponentSearch::explore(size_t c, const EquivalenceClass &start, const std::vector<EdgeID> *goal,
+		std::vector<EquivalenceClass> &states, std::vector<ParentLink> &parents) {
+	states.clear();
+	parents.clear();
+	std::function<size_t(size_t)> state_hash = [&states](size_t k) { return states[k].hash(); };
+	std::function<bool(size_t, size_t)> state_equal = [&states](size_t a, size_t b) { return states[a] == states[b]; };
+	std::unordered_set<size_t, std::function<size_t(size_t)>, std::function<bool(size_t, size_t)> >
+		classes_history(16, state_hash, state_equal);
+
+	states.push_back(start);
+	states.back() &= mask_[c];
+	parents.push_back({ no_parent, 0, 0 });
+	classes_history.insert(0);
+	bytes_ = retained_bytes_ + stateBytes(states[0]) + sizeof(ParentLink);
+	if (goal && satisfiedAll(states[0], *goal))
+		return 0;
+
+	const std::vector<VertexIndex> &members = condensation_.members[c];
+	for (size_t head = 0; head < states.size(); head++) {
+		if (budget_) {
+			peak_bytes_ = std::max(peak_bytes_, bytes_);
+			stop_ = budget_->check(expanded_, bytes_);
+			if (stop_ != Solver::NOT_STOPPED)
+				return no_parent;
+		}
+		for (std::vector<VertexIndex>::const_iterator v = members.begin(); v != members.end(); v++) {
+			if (!movable_[*v] || !internalSatisfied(*v, states[head]))
+				continue;
+			const Vertex &vertex = g_.vertexAt(*v);
+			const ValueClasses &equiv_classes = vertex.equivalenceClasses();
+			for (size_t k = 0; k < equiv_classes.size(); k++) {
+				states.push_back(merge(states[head], equiv_classes[k].edges_bitset, equiv_classes[k].unsatisfied_edges));
+				states.back() &= mask_[c];
+				if (!classes_history.insert(states.size() - 1).second) {
+					states.pop_back();
+					if (budget_)
+						threadStats().duplicateStates++;
+					continue;
+				}
+				parents.push_back({ head, vertex.id, k });
+				if (budget_) {
+					expanded_++;
+					bytes_ += stateBytes(states.back()) + sizeof(ParentLink);
+					threadStats().countBranch(*v);
+				}
+				if (goal && satisfiedAll(states.back(), *goal))
+					return states.size() - 1;
+			}
+		}
+	}
+	peak_bytes_ = std::max(peak_bytes_, bytes_);
+	return no_parent;
+}
+
+// Оставляет максимальные по включению состояния интерфейса: меньшие не дают вышележащим вершинам новых возможностей
+void ComponentSearch::collectReachable(size_t c, const std::vector<EquivalenceClass> &states) {
+	std::unordered_set<EdgesBitset> distinct;
+	for (std::vector<EquivalenceClass>::const_iterator s = states.begin(); s != states.end(); s++) {
+		EdgesBitset projection(*s);
+		projection &= interface_[c];
+		distinct.insert(projection);
+	}
+	std::vector<EdgesBitset> candidates(distinct.begin(), distinct.end());
+	std::sort(candidates.begin(), candidates.end(), [](const EdgesBitset &a, const EdgesBitset &b) {
+		return a.count() > b.count() || (a.count() == b.count() && a.words() < b.words());
+	});
+	std::vector<EdgesBitset> &kept = reachable_[c];
+	for (std::vector<EdgesBitset>::const_iterator s = candidates.begin(); s != candidates.end(); s++) {
+		bool covered = false;
+		for (std::vector<EdgesBitset>::const_iterator k = kept.begin(); k != kept.end() && !covered; k++)
+			covered = s->isSubsetOf(*k);
+		if (!covered) {
+			kept.push_back(*s);
+			retained_bytes_ += stateBytes(*s);
+		}
+	}
+}
+
+Solver::Outcome ComponentSearch::solve(SearchBudget &budget) {
+	budget_ = &budget;
+	const size_t target_component = condensation_.component[target_];
+	std::vector<size_t> components;
+	for (VertexIndex v = 0; v < g_.vertices().size(); v++)
+		if (influence_.vertices[v] && condensation_.component[v] != target_component)
+			components.push_back(condensation_.component[v]);
+	std::sort(components.begin(), components.end());
+	components.erase(std::unique(components.begin(), components.end()), components.end());
+
+	std::vector<EquivalenceClass> states;
+	std::vector<ParentLink> parents;
+	for (std::vector<size_t>::const_iterator c = components.begin(); c != components.end(); c++) {
+		const std::vector<VertexIndex> &members = condensation_.members[*c];
+		for (std::vector<VertexIndex>::const_iterator v = members.begin(); v != members.end(); v++)
+			movable_[*v] = feasible(requirements_[*v]);
+		explore(*c, start_.satisfied, 0, states, parents);
+		if (stop_ != Solver::NOT_STOPPED)
+			return Solver::UNKNOWN;
+		collectReachable(*c, states);
+	}
+
+	// Ребра цели в нижние компоненты не зависят от ее компоненты; остальные проверяются перебором
+	if (!feasible(requirements_[target_]))
+		return Solver::INACCESSIBLE;
+	const std::vector<VertexIndex> &members = condensation_.members[target_component];
+	for (std::vector<VertexIndex>::const_iterator v = members.begin(); v != members.end(); v++)
+		movable_[*v] = influence_.vertices[*v] && feasible(requirements_[*v]);
+	if (explore(target_component, start_.satisfied, &target_edges_, states, parents) != no_parent)
+		return Solver::ACCESSIBLE;
+	return stop_ != Solver::NOT_STOPPED ? Solver::UNKNOWN : Solver::INACCESSIBLE;
+}
+
+// Приводит компоненту c к состоянию, в котором выполнены ребра required, изменяя state.
+// Перед каждым изменением вершины в нужное состояние приводятся нижние компоненты, от которых она зависит.
+void ComponentSearch::realize(GraphState &state, size_t c, const std::vector<EdgeID> &required,
+		const Solver &solver, std::stack<Solver::UpdateInfo> &trace) {
+	std::vector<EquivalenceClass> states;
+	std::vector<ParentLink> parents;
+	const size_t found = explore(c, state.satisfied, &required, states, parents);
+	assert(found != no_parent); // Следует из достижимости, установленной в solve()
+	std::vector<size_t> path;
+	for (size_t k = found; parents[k].parent != no_parent; k = parents[k].parent)
+		path.push_back(k);
+	for (std::vector<size_t>::reverse_iterator k = path.rbegin(); k != path.rend(); k++) {
+		const ParentLink &link = parents[*k];
+		const Vertex &vertex = g_.vertex(link.vid);
+		realizeRequirements(state, vertex.index(), solver, trace);
+		ValueType new_value = vertex.equivalenceClasses()[link.value_class].val;
+		ValueType old_value = g_.setValue(state, link.vid, new_value);
+		trace.push({ link.vid, old_value, new_value });
+		AV_TRACE_EVENT(solver, AV_TRACE_STEPS, TraceEvent::CHANGE, trace.size(), link.vid, old_value, new_value);
+	}
+}
+
+void ComponentSearch::realizeRequirements(GraphState &state, VertexIndex v,
+		const Solver &solver, std::stack<Solver::UpdateInfo> &trace) {
+	const std::vector<Requirement> &requirements = requirements_[v];
+	for (std::vector<Requirement>::const_iterator r = requirements.begin(); r != requirements.end(); r++)
+		realize(state, r->component, r->edges, solver, trace);
+}
+
+void ComponentSearch::witness(const Solver &solver, std::stack<Solver::UpdateInfo> &trace) {
+	budget_ = 0;
+	const Graph::Checkpoint mark = g_.checkpoint(start_);
+	realize(start_, condensation_.component[target_], target_edges_, solver, trace);
+	realizeRequirements(start_, target_, solver, trace);
+	assert(start_.accessible.contains(target_));
+	g_.rollback(start_, mark);
+}
+
+bool Solver::componentSolver(const Graph &g, VertexID target) {
+	GraphState start = g.state();
+	return componentSolver(g, start, target);
+}
+
+bool Solver::componentSolver(const Graph &g, GraphState &start, VertexID target) {
+	return componentSolver(g, start, target, computeCondensation(g));
+}
+
+bool Solver::componentSolver(const Graph &g, GraphState &start, VertexID target, const Condensation &condensation) {
+	this->trace = std::stack<UpdateInfo>();
+	this->statesExpanded = 0;
+	this->historyBytes = 0;
+	this->stopReason = NOT_STOPPED;
+	this->outcome = INACCESSIBLE;
+	StatsScope stats_scope(*this, g);
+	g.update(start); // Состояние могло быть скопировано до изменений структуры графа
+	if (!g.hasVertex(target))
+		return false;
+	const Vertex &target_vertex = g.vertex(target);
+	if (target_vertex.checkAccessibility(start.satisfied)) {
+		outcome = ACCESSIBLE;
+		return true;
+	}
+
+	const TargetInfluence influence = computeInfluence(g, target);
+	// Изменение вершины с петлей может сделать ее недоступной, и тогда его нельзя отменить
+	for (EdgeID e = 0; e < g.edgesCount(); e++)
+		if (g.edgeFrom(e) == g.edgeTo(e) && influence.edges.test(e))
+			return shortestSolver(g, start, target);
+
+	ComponentSearch search(g, start, influence, target_vertex.index(), condensation);
+	SearchBudget budget(options);
+	outcome = search.solve(budget);
+	statesExpanded = search.statesExpanded();
+	historyBytes = search.historyBytes();
+	stopReason = search.stopReason();
+	if (outcome != ACCESSIBLE) {
+		AV_TRACE_EVENT(*this, AV_TRACE_RESULT, TraceEvent::FAILURE, 0);
+		return false;
+	}
+
+	search.witness(*this, trace);
+	AV_TRACE_EVENT(*this, AV_TRACE_RESULT, TraceEvent::SUCCESS, trace.size());
+	return true;
+}
@@ -0,0 +1,149 @@
+﻿#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Битовое множество ребер, размер которого задается во время выполнения.
+// Биты упакованы в 64-битные слова; объединение, пересечение, разность,
+// подсчет и хеширование выполняются пословно.
+// Неиспользуемые старшие биты последнего слова всегда равны нулю.
+// Операнды могут иметь разный размер: недостающие биты считаются нулевыми, размер результата - размер this.
+class EdgeSet {
+public:
+	typedef uint64_t Word;
+	static const size_t word_bits = 64;
+
+	EdgeSet() : size_(0) {}
+	explicit EdgeSet(size_t n) : words_(wordsFor(n), 0), size_(n) {}
+	// Множество из n бит, заданных словами words[0 .. wordsFor(n))
+	EdgeSet(size_t n, const Word *words) : words_(words, words + wordsFor(n)), size_(n) { trim(); }
+
+	static size_t wordsFor(size_t n) { return (n + word_bits - 1) / word_bits; }
+
+	size_t size() const { return size_; }
+	void resize(size_t n) { words_.resize(wordsFor(n), 0); size_ = n; trim(); }
+
+	bool test(size_t k) const { return (words_[k / word_bits] >> (k % word_bits)) & 1; }
+	bool operator[](size_t k) const { return test(k); }
+	void set(size_t k, bool value = true) {
+		Word mask = Word(1) << (k % word_bits);
+		if (value)
+			words_[k / word_bits] |= mask;
+		else
+			words_[k / word_bits] &= ~mask;
+	}
+	void reset(size_t k) { set(k, false); }
+	void clear() { std::fill(words_.begin(), words_.end(), 0); }
+
+	size_t count() const {
+		size_t n = 0;
+		for (size_t w = 0; w < words_.size(); w++)
+			n += popcount(words_[w]);
+		return n;
+	}
+	bool any() const {
+		for (size_t w = 0; w < words_.size(); w++)
+			if (words_[w])
+				return true;
+		return false;
+	}
+	bool none() const { return !any(); }
+
+	// Все биты this содержатся в other
+	bool isSubsetOf(const EdgeSet &other) const {
+		const size_t common = std::min(words_.size(), other.words_.size());
+		for (size_t w = 0; w < common; w++)
+			if (words_[w] & ~other.words_[w])
+				return false;
+		for (size_t w = common; w < words_.size(); w++)
+			if (words_[w])
+				return false;
+		return true;
+	}
+
+	EdgeSet& operator|=(const EdgeSet &other) {
+		const size_t common = std::min(words_.size(), other.words_.size());
+		for (size_t w = 0; w < common; w++)
+			words_[w] |= other.words_[w];
+		if (other.size_ > size_)
+			trim();
+		return *this;
+	}
+	EdgeSet& operator&=(const EdgeSet &other) {
+		const size_t common = std::min(words_.size(), other.words_.size());
+		for (size_t w = 0; w < common; w++)
+			words_[w] &= other.words_[w];
+		std::fill(words_.begin() + common, words_.end(), 0);
+		return *this;
+	}
+	// this = this & ~other
+	EdgeSet& andNot(const EdgeSet &other) {
+		const size_t common = std::min(words_.size(), other.words_.size());
+		for (size_t w = 0; w < common; w++)
+			words_[w] &= ~other.words_[w];
+		return *this;
+	}
+
+	bool operator==(const EdgeSet &other) const { return size_ == other.size_ && words_ == other.words_; }
+	bool operator!=(const EdgeSet &other) const { return !(*this == other); }
+
+	size_t hash() const {
+		uint64_t h = 0x9E3779B97F4A7C15ULL ^ size_;
+		for (size_t w = 0; w < words_.size(); w++)
+			h = mix(h ^ words_[w]);
+		return static_cast<size_t>(h);
+	}
+
+	const std::vector<Word>& words() const { return words_; }
+
+	static size_t popcount(Word w) {
+#if defined(_MSC_VER) && defined(_M_X64)
+		return static_cast<size_t>(__popcnt64(w));
+#elif defined(__GNUC__)
+		return static_cast<size_t>(__builtin_popcountll(w));
+#else
+		size_t n = 0;
+		for (; w; w &= w - 1)
+			n++;
+		return n;
+#endif
+	}
+
+	// Финализатор splitmix64
+	static uint64_t mix(uint64_t x) {
+		x += 0x9E3779B97F4A7C15ULL;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+	// Печать в том же порядке, что и у std::bitset: старшие биты слева
+	friend std::ostream& operator<<(std::ostream &os, const EdgeSet &s) {
+		for (size_t k = s.size_; k > 0; k--)
+			os << (s.test(k - 1) ? '1' : '0');
+		return os;
+	}
+
+private:
+	std::vector<Word> words_;
+	size_t size_;
+
+	void trim() {
+		if (size_ % word_bits)
+			words_.back() &= (Word(1) << (size_ % word_bits)) - 1;
+	}
+};
+
+namespace std {
+	template<> struct hash<EdgeSet> {
+		size_t operator()(const EdgeSet &s) const { return s.hash(); }
+	};
+}
@@ -1,7 +1,11 @@
 ﻿
 #include <iostream>
 #include <limits>
+#include <cmath>
 #include <cassert>
+#include <cstring>
+#include <thread>
+#include <chrono>
 
 #include "AccessValidator.h"
 
@@ -9,96 +13,253 @@
 // Vertices
 //
 
-static void checkEdgeUniqueness(const Edges& edges, Vertex *v, bool reverse_edge) {
-	Edges::const_iterator it = std::find_if(edges.begin(), edges.end(), [&](const Edge* e) { return (reverse_edge ? e->to : e->from) == v; });
-	if (it != edges.end())
-		throw DuplicatedEdge();
+void Vertex::setValue(const ValueType &val)
+{
+	g_->setValue(id, val);
 }
 
-Edge* Vertex::addInEdge(Edge *edge) {
-	checkEdgeUniqueness(in_, edge->from, true);
-	in_.push_back(edge);
-	return edge;
+// Элементарные участки числовой прямой, порожденные упорядоченными точками x_0 < ... < x_{n-1}:
+// (-inf, x_0), {x_0}, (x_0, x_1), {x_1}, ..., {x_{n-1}}, (x_{n-1}, +inf).
+// Участок с нечетным номером 2i+1 - точка x_i, с четным номером - открытый промежуток.
+static size_t pointSegment(const std::vector<double> &points, double x) {
+	return 2 * (std::lower_bound(points.begin(), points.end(), x) - points.begin()) + 1;
 }
 
-void Vertex::addOutEdge(Edge *edge) {
-	checkEdgeUniqueness(out_, edge->to, false);
-	out_.push_back(edge);
-	edge->to->addInEdge(edge);
+// Значение, лежащее на элементарном участке с номером s
+static double segmentSample(const std::vector<double> &points, size_t s) {
+	if (s % 2 == 1)
+		return points[s / 2];
+	if (points.empty())
+		return 0.0;
+	if (s == 0)
+		return points.front() - 1.0 - std::fabs(points.front());
+	if (s == 2 * points.size())
+		return points.back() + 1.0 + std::fabs(points.back());
+	double left = points[s / 2 - 1], right = points[s / 2];
+	return left + 0.5 * (right - left);
 }
 
-void Vertex::changeAccessibility(bool new_value) {
-	if (new_value == accessible_)
+// Дерево отрезков над кандидатами: прибавление на отрезке [first, end) и максимум на нем.
+// tree_max[node] - максимум поддерева с учетом собственных прибавлений tree_add[node].
+static void treeAdd(ClassScratch &scratch, size_t node, size_t l, size_t r, size_t first, size_t end, int64_t delta) {
+	if (end <= l || r <= first)
+		return;
+	if (first <= l && r <= end) {
+		scratch.tree_max[node] += delta;
+		scratch.tree_add[node] += delta;
 		return;
-	accessible_ = new_value;
-	g_->toggleVertexAccessibility(id, accessible_);
+	}
+	size_t m = l + (r - l) / 2;
+	treeAdd(scratch, 2 * node, l, m, first, end, delta);
+	treeAdd(scratch, 2 * node + 1, m, r, first, end, delta);
+	scratch.tree_max[node] = std::max(scratch.tree_max[2 * node], scratch.tree_max[2 * node + 1]) + scratch.tree_add[node];
 }
 
-void Vertex::setValue(const ValueType &val)
-{
-	if(!accessible_)
-		throw Inaccessible();
-	val_ = val;
-	for (Edges::iterator it = in_.begin(); it != in_.end(); it++) {
-		Edge *pe = *it;
-		pe->satisfied = pe->p->check(val_);
-		g_->currentClass_[pe->seq] = pe->satisfied;
-		if (!pe->satisfied) {
-			pe->from->changeAccessibility(false);
-		}
-		else {
-			pe->from->changeAccessibility(pe->from->checkAccessibility());
-		}
-	}
+static int64_t treeMax(const ClassScratch &scratch, size_t node, size_t l, size_t r, size_t first, size_t end) {
+	if (end <= l || r <= first)
+		return std::numeric_limits<int64_t>::min();
+	if (first <= l && r <= end)
+		return scratch.tree_max[node];
+	size_t m = l + (r - l) / 2;
+	int64_t best = std::max(treeMax(scratch, 2 * node, l, m, first, end), treeMax(scratch, 2 * node + 1, m, r, first, end));
+	return best == std::numeric_limits<int64_t>::min() ? best : best + scratch.tree_add[node];
 }
 
-static bool covered(const SatisfiedEdges &se, const ValueClasses &classes)
-{
-	for (ValueClasses::const_iterator vc = classes.begin(); vc != classes.end(); vc++) {
-		bool covered = true;
-		for (int k = 0; k < se.size() && covered; k++) {
-			if (se[k] && !vc->edges_bitset[k])
-				covered = false;
-		}
-		if (covered)
-			return true;
-	}
-	return false;
+// Множества входящих ребер, выполненных на участке, хранятся подряд по words слов;
+// бит k соответствует k-му входящему ребру
+static size_t patternSize(const EdgeSet::Word *p, size_t words) {
+	size_t n = 0;
+	for (size_t w = 0; w < words; w++)
+		n += EdgeSet::popcount(p[w]);
+	return n;
 }
 
 void Vertex::computeEquivalenceClasses()
 {
+	ClassScratch scratch;
+	computeEquivalenceClasses(scratch);
+}
+
+void Vertex::computeEquivalenceClasses(ClassScratch &scratch)
+{
+	const size_t edges_count = g_->edgesCount();
+	const Edges in_ = predecessors();
+	classes_.clear();
 	if (in_.size() == 0) {
-                SatisfiedEdges se_empty;
-                EdgesBitset ebs_empty;
-		classes_.push_back(ValueClass(1.23456, se_empty, ebs_empty));
+		classes_.push_back(ValueClass(1.23456, SatisfiedEdges(edges_count), EdgesBitset(edges_count)));
 		return; // No incoming edges
 	}
-	// Заполним вектор порядковых номеров входящих ребер
-	EdgesBitset incoming_bitset;
-	std::vector<size_t> ids(in_.size());
+
+	// Все конечные границы интервалов входящих предикатов делят прямую на элементарные участки,
+	// на каждом из которых множество выполненных ребер постоянно.
+	std::vector<double> &points = scratch.points;
+	points.clear();
 	for (size_t k = 0; k < in_.size(); k++) {
-		incoming_bitset[in_.at(k)->seq] = true;
-		ids[k] = in_.at(k)->seq;
-	}
-
-	// Переберем все подмножества входящих ребер и проверим возможность их выполнимости.
-	// Это можно значительно ускорить, но надо ли?
-	for (size_t bitset = (1 << in_.size()) - 1; bitset > 0; --bitset) {
-		Predicate pred;
-		SatisfiedEdges se;
-		EdgesBitset unsatisfied = incoming_bitset;
-		for (int k = 0; k < in_.size() && !pred.isEmpty(); k++) {
-			if (bitset & (1 << k)) {
-				se[ids[k]] = true;
-				unsatisfied[ids[k]] = false;
-				pred = intersect(pred, *(in_.at(k)->p));
-			}
+		const std::vector<Interval> &intervals = g_->edgePredicate(in_[k]).intervals();
+		for (std::vector<Interval>::const_iterator i = intervals.begin(); i != intervals.end(); i++) {
+			if (!std::isinf(i->left))
+				points.push_back(i->left);
+			if (!std::isinf(i->right))
+				points.push_back(i->right);
 		}
-		if (!pred.isEmpty() && !covered(se, classes_)) {
-			std::cerr << pred << std::endl;
-			classes_.push_back(ValueClass(pred.sample(), se, unsatisfied));
+	}
+	std::sort(points.begin(), points.end());
+	points.erase(std::unique(points.begin(), points.end()), points.end());
+	const size_t last_segment = 2 * points.size();
+
+	// Интервал ребра k покрывает участки [first, last]: событие +1 на first и -1 на last+1
+	std::vector<ClassScratch::Event> &events = scratch.events;
+	events.clear();
+	std::vector<ClassScratch::Range> &ranges = scratch.ranges;
+	ranges.clear();
+	for (size_t k = 0; k < in_.size(); k++) {
+		const std::vector<Interval> &intervals = g_->edgePredicate(in_[k]).intervals();
+		for (std::vector<Interval>::const_iterator i = intervals.begin(); i != intervals.end(); i++) {
+			size_t first = std::isinf(i->left) ? 0 : pointSegment(points, i->left) + ((i->border & Interval::LEFT_CLOSED) ? 0 : 1);
+			size_t last = std::isinf(i->right) ? last_segment : pointSegment(points, i->right) - ((i->border & Interval::RIGHT_CLOSED) ? 0 : 1);
+			if (first > last)
+				continue; // Пустой интервал
+			events.push_back({ first, k, +1 });
+			events.push_back({ last + 1, k, -1 });
+			ranges.push_back({ k, first, last });
+		}
+	}
+	std::sort(events.begin(), events.end());
+
+	// Проход по участкам слева направо. Максимальными могут быть только те множества ребер,
+	// которые держатся от последнего добавления ребра до ближайшего удаления.
+	const size_t words = EdgeSet::wordsFor(in_.size());
+	std::vector<int> &cover = scratch.cover;
+	cover.assign(in_.size(), 0);
+	std::vector<EdgeSet::Word> &current = scratch.current;
+	current.assign(words, 0);
+	std::vector<EdgeSet::Word> &patterns = scratch.patterns;
+	patterns.clear();
+	std::vector<double> &samples = scratch.samples;
+	samples.clear();
+	std::vector<size_t> &sample_segments = scratch.sample_segments;
+	sample_segments.clear();
+	std::vector<size_t> &changed = scratch.changed;
+	size_t sample_segment = 0;
+	bool added = false;
+	for (size_t e = 0; e < events.size(); ) {
+		const size_t segment = events[e].segment;
+		changed.clear();
+		for (; e < events.size() && events[e].segment == segment; e++) {
+			int &c = cover[events[e].edge];
+			if (c == 0 || c + events[e].delta == 0)
+				changed.push_back(events[e].edge);
+			c += events[e].delta;
+		}
+		bool removed = false, appeared = false;
+		for (size_t j = 0; j < changed.size(); j++) {
+			size_t k = changed[j];
+			bool active = cover[k] > 0;
+			bool was_active = ((current[k / EdgeSet::word_bits] >> (k % EdgeSet::word_bits)) & 1) != 0;
+			removed = removed || (was_active && !active);
+			appeared = appeared || (!was_active && active);
+		}
+		if (removed && added) {
+			patterns.insert(patterns.end(), current.begin(), current.end());
+			samples.push_back(segmentSample(points, sample_segment));
+			sample_segments.push_back(sample_segment);
+		}
+		for (size_t j = 0; j < changed.size(); j++) {
+			size_t k = changed[j];
+			EdgeSet::Word mask = EdgeSet::Word(1) << (k % EdgeSet::word_bits);
+			if (cover[k] > 0)
+				current[k / EdgeSet::word_bits] |= mask;
+			else
+				current[k / EdgeSet::word_bits] &= ~mask;
+		}
+		if (removed)
+			added = false;
+		if (appeared) {
+			added = true;
+			sample_segment = segment;
+		}
+	}
+
+	// Оставляем только максимальные по включению множества: подмножества выполненных ребер
+	// не дают перебору новых возможностей, поскольку доступность монотонна по выполненным ребрам.
+	// Попарное сравнение кандидатов квадратично, поэтому считаем совпадения вторым проходом.
+	// Кандидат c появился на участке sample_segments[c] и состоит из ребер, выполненных на нем.
+	// Число общих ребер кандидатов s и t - число прямоугольников I x J, содержащих точку (s, t),
+	// где I и J - участки выполнения одного ребра. Проход по s прибавляет к листам t вес weight
+	// за каждое общее ребро; кандидат s поглощен, если у какого-то t общих ребер столько же, сколько у s,
+	// и t больше s или равен ему, но идет раньше. Размер и порядок t кодируются младшими разрядами листа.
+	// Время O((R + C) log C), где C - число кандидатов, R - сумма квадратов числа участков по ребрам.
+	const size_t candidates = samples.size();
+	std::vector<size_t> &sizes = scratch.sizes, &kept = scratch.kept;
+	sizes.resize(candidates);
+	for (size_t c = 0; c < candidates; c++)
+		sizes[c] = patternSize(&patterns[c * words], words);
+
+	// Участки выполнения ребра переводятся в номера кандидатов [first, last]; соседние и перекрытые участки сливаются
+	std::sort(ranges.begin(), ranges.end());
+	size_t merged = 0;
+	for (size_t i = 0; i < ranges.size(); i++) {
+		if (merged > 0 && ranges[merged - 1].edge == ranges[i].edge && ranges[i].first <= ranges[merged - 1].last + 1)
+			ranges[merged - 1].last = std::max(ranges[merged - 1].last, ranges[i].last);
+		else
+			ranges[merged++] = ranges[i];
+	}
+	ranges.resize(merged);
+	size_t spans = 0;
+	for (size_t i = 0; i < ranges.size(); i++) {
+		size_t first = std::lower_bound(sample_segments.begin(), sample_segments.end(), ranges[i].first) - sample_segments.begin();
+		size_t end = std::upper_bound(sample_segments.begin(), sample_segments.end(), ranges[i].last) - sample_segments.begin();
+		if (first < end)
+			ranges[spans++] = { ranges[i].edge, first, end - 1 };
+	}
+	ranges.resize(spans);
+
+	const int64_t weight = 2 * static_cast<int64_t>(in_.size()) + 2;
+	std::vector<ClassScratch::Rectangle> &rectangles = scratch.rectangles;
+	rectangles.clear();
+	for (size_t i = 0; i < ranges.size(); ) {
+		size_t edge_end = i;
+		while (edge_end < ranges.size() && ranges[edge_end].edge == ranges[i].edge)
+			edge_end++;
+		for (size_t a = i; a < edge_end; a++)
+			for (size_t b = i; b < edge_end; b++) {
+				rectangles.push_back({ ranges[a].first, ranges[b].first, ranges[b].last + 1, weight });
+				rectangles.push_back({ ranges[a].last + 1, ranges[b].first, ranges[b].last + 1, -weight });
+			}
+		i = edge_end;
+	}
+	std::sort(rectangles.begin(), rectangles.end());
+
+	size_t tree_size = 1;
+	while (tree_size < candidates)
+		tree_size *= 2;
+	scratch.tree_max.assign(2 * tree_size, 0);
+	scratch.tree_add.assign(2 * tree_size, 0);
+	for (size_t c = 0; c < candidates; c++)
+		treeAdd(scratch, 1, 0, tree_size, c, c + 1, 2 * static_cast<int64_t>(sizes[c]));
+	kept.clear();
+	for (size_t c = 0, r = 0; c < candidates; c++) {
+		for (; r < rectangles.size() && rectangles[r].x <= c; r++)
+			treeAdd(scratch, 1, 0, tree_size, rectangles[r].y_first, rectangles[r].y_end, rectangles[r].delta);
+		const int64_t size = static_cast<int64_t>(sizes[c]);
+		int64_t best = std::max(treeMax(scratch, 1, 0, tree_size, 0, c), treeMax(scratch, 1, 0, tree_size, c + 1, candidates));
+		if (best < weight * size + 2 * size + 1)
+			kept.push_back(c);
+		treeAdd(scratch, 1, 0, tree_size, c, c + 1, 1); // Равные кандидаты после c поглощаются им
+	}
+	std::stable_sort(kept.begin(), kept.end(), [&sizes](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+	classes_.reserve(kept.size());
+	for (size_t i = 0; i < kept.size(); i++) {
+		const EdgeSet::Word *pattern = &patterns[kept[i] * words];
+		SatisfiedEdges se(edges_count);
+		EdgesBitset unsatisfied(edges_count);
+		for (size_t k = 0; k < in_.size(); k++) {
+			if ((pattern[k / EdgeSet::word_bits] >> (k % EdgeSet::word_bits)) & 1)
+				se.set(in_[k]);
+			else
+				unsatisfied.set(in_[k]);
 		}
+		classes_.push_back(ValueClass(samples[kept[i]], std::move(se), std::move(unsatisfied)));
 	}
 }
 
@@ -108,18 +269,22 @@ Vertex::~Vertex() {
 
 
 std::ostream& operator<<(std::ostream& os, const Vertex& v) {
-	os << "Vertex " << v.id << ", value = " << v.val_  << "\n";
+	os << "Vertex " << v.id << ", value = " << v.value()  << "\n";
 	os << "\tIncoming edges are:\n";
-	if (v.in_.begin() == v.in_.end())
+	const Graph &g = *v.g_;
+	Edges in = v.predecessors(), out = v.successors();
+	if (in.empty())
 		os << "\tNone\n";
-	for (Edges::const_iterator e = v.in_.begin(); e != v.in_.end(); e++) {
-		os << "\t<- " << (*e)->from->id << " [" << (*e)->from->val_ << "] " << *((*e)->p) << "\n";
+	for (Edges::const_iterator e = in.begin(); e != in.end(); e++) {
+		const Vertex &from = g.vertexAt(g.edgeFrom(*e));
+		os << "\t<- " << from.id << " [" << from.value() << "] " << g.edgePredicate(*e) << "\n";
 	}
 	os << "\tOutcoming edges are:\n";
-	if (v.out_.begin() == v.out_.end())
+	if (out.empty())
 		os << "\tNone\n";
-	for (Edges::const_iterator e = v.out_.begin(); e != v.out_.end(); e++) {
-		os << "\t-> " << (*e)->to->id << " [" << (*e)->to->val_ << "] " << *((*e)->p) << "\n";
+	for (Edges::const_iterator e = out.begin(); e != out.end(); e++) {
+		const Vertex &to = g.vertexAt(g.edgeTo(*e));
+		os << "\t-> " << to.id << " [" << to.value() << "] " << g.edgePredicate(*e) << "\n";
 	}
 	os << "\tEquivalence classes:\n";
 	for (ValueClasses::const_iterator vc = v.classes_.begin(); vc != v.classes_.end(); vc++) {
@@ -133,80 +298,635 @@ std::ostream& operator<<(std::ostream& os, const Vertex& v) {
 // Graphs
 //
 
-Vertex *Graph::addVertex(VertexID vid, const ValueType &val) {
-	VerticesMap::iterator v = vertices_.find(vid);
-	if (v == vertices_.end()) {
-		std::pair<VerticesMap::iterator, bool> ret;
-		ret = vertices_.insert(VerticesMap::value_type(vid, Vertex(this, vid, val)));
-		v = ret.first;
+VertexIndex Graph::addVertex(VertexID vid, const ValueType &val) {
+	std::pair<std::unordered_map<VertexID, VertexIndex>::iterator, bool> ret =
+		indices_.insert(std::make_pair(vid, static_cast<VertexIndex>(vertices_.size())));
+	if (ret.second) {
+		vertices_.push_back(Vertex(this, vid, ret.first->second));
+		state_.values.push_back(val);
+	}
+	return ret.first->second;
+}
+
+//
+// Adjacency
+//
+
+void Adjacency::build(const std::vector<VertexIndex> &keys, size_t vertices_count) {
+	std::vector<EdgeID> offsets(vertices_count + 1, 0);
+	for (size_t e = 0; e < keys.size(); e++)
+		offsets[keys[e] + 1]++;
+	for (size_t v = 0; v < vertices_count; v++)
+		offsets[v + 1] += offsets[v];
+	std::vector<EdgeID> edges(keys.size());
+	std::vector<EdgeID> next(offsets.begin(), offsets.end() - 1);
+	for (size_t e = 0; e < keys.size(); e++)
+		edges[next[keys[e]]++] = static_cast<EdgeID>(e);
+	assign(offsets.data(), edges.data(), vertices_count);
+}
+
+void Adjacency::assign(const EdgeID *offsets, const EdgeID *edges, size_t vertices_count) {
+	begin_.assign(offsets, offsets + vertices_count);
+	size_.resize(vertices_count);
+	for (size_t v = 0; v < vertices_count; v++)
+		size_[v] = offsets[v + 1] - offsets[v];
+	capacity_ = size_;
+	edges_.assign(edges, edges + offsets[vertices_count]);
+	unused_ = 0;
+}
+
+void Adjacency::exportCSR(std::vector<EdgeID> &offsets, std::vector<EdgeID> &edges) const {
+	offsets.assign(1, 0);
+	edges.clear();
+	for (size_t v = 0; v < begin_.size(); v++) {
+		Edges list = (*this)[static_cast<VertexIndex>(v)];
+		edges.insert(edges.end(), list.begin(), list.end());
+		offsets.push_back(static_cast<EdgeID>(edges.size()));
 	}
-	return &(v->second);
 }
 
-Graph::Graph(const std::vector<edge_info>& edges, VerticesValues values, const std::vector<Predicate>& predicates)
+void Adjacency::insert(VertexIndex v, EdgeID e) {
+	if (size_[v] == capacity_[v]) {
+		// Переносим список в конец массива
+		EdgeID capacity = std::max<EdgeID>(4, 2 * capacity_[v]);
+		EdgeID first = static_cast<EdgeID>(edges_.size());
+		edges_.resize(edges_.size() + capacity);
+		std::copy(edges_.begin() + begin_[v], edges_.begin() + begin_[v] + size_[v], edges_.begin() + first);
+		unused_ += capacity_[v];
+		begin_[v] = first;
+		capacity_[v] = capacity;
+	}
+	edges_[begin_[v] + size_[v]++] = e;
+	if (2 * unused_ > edges_.size())
+		compact();
+}
+
+void Adjacency::compact() {
+	std::vector<EdgeID> offsets, edges;
+	exportCSR(offsets, edges);
+	assign(offsets.data(), edges.data(), begin_.size());
+}
+
+void Graph::buildAdjacency() {
+	out_.build(edge_from_, vertices_.size());
+	in_.build(edge_to_, vertices_.size());
+	checkDuplicatedEdges();
+}
+
+void Graph::checkDuplicatedEdges() const {
+	std::vector<size_t> last_source(vertices_.size(), vertices_.size());
+	for (VertexIndex v = 0; v < vertices_.size(); v++) {
+		Edges out = outEdges(v);
+		for (Edges::const_iterator e = out.begin(); e != out.end(); e++) {
+			if (last_source[edge_to_[*e]] == v)
+				throw DuplicatedEdge();
+			last_source[edge_to_[*e]] = v;
+		}
+	}
+}
+
+Graph::Graph(const std::vector<edge_info>& edges, VerticesValues values, const std::vector<Predicate>& predicates,
+		unsigned threads)
+	: predicates_(predicates)
 {
-	edges_.reserve(edges.size());
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	edge_from_.reserve(edges.size());
+	edge_to_.reserve(edges.size());
+	edge_predicate_.reserve(edges.size());
 
 	for (std::vector<edge_info>::const_iterator e = edges.begin(); e != edges.end(); e++) {
-		Vertex *v_from = addVertex(e->from, values[e->from]);
-		Vertex *v_to = addVertex(e->to, values[e->to]);
-		const Predicate *p = &(predicates.at(e->predicate));
-		Edge *edge = new Edge({ v_from, v_to, p, p->check(v_to->value()), edges_.size() });
-		edges_.push_back(edge);
-		v_from->addOutEdge(edge);
+		predicates.at(e->predicate); // Проверка номера предиката
+		edge_from_.push_back(addVertex(e->from, values[e->from]));
+		edge_to_.push_back(addVertex(e->to, values[e->to]));
+		edge_predicate_.push_back(e->predicate);
 	}
-	for (VerticesMap::iterator v = vertices_.begin(); v != vertices_.end(); v++) {
-		v->second.computeEquivalenceClasses();
-		if (v->second.checkAccessibility()) {
-			accessibleVertices_.insert(v->second.id);
-			v->second.accessible_ = true;
+	buildAdjacency();
+	countPredicateUses();
+	buildKernels();
+	initState();
+	computeFingerprint();
+	const std::chrono::steady_clock::time_point classes_start = std::chrono::steady_clock::now();
+	computeClasses(threads);
+	recordBuildTime(start, classes_start);
+}
+
+void Graph::recordBuildTime(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point classes_start) {
+	build_seconds_ = std::chrono::duration<double>(classes_start - start).count();
+	classes_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - classes_start).count();
+	SolverStats &counters = threadStats();
+	counters.buildSeconds += build_seconds_;
+	counters.classesSeconds += classes_seconds_;
+}
+
+void Graph::initState() {
+	state_.satisfied = EquivalenceClass(edgesCount());
+	state_.unsatisfied_out.assign(vertices_.size(), 0);
+	state_.accessible.resize(vertices_.size());
+	for (EdgeID e = 0; e < edgesCount(); e++) {
+		bool satisfied = edge_kernel_[e].check(state_.values[edge_to_[e]]);
+		state_.satisfied.set(e, satisfied);
+		if (!satisfied)
+			state_.unsatisfied_out[edge_from_[e]]++;
+	}
+	for (VertexIndex v = 0; v < vertices_.size(); v++) {
+		if (state_.unsatisfied_out[v] == 0)
+			state_.accessible.insert(v);
+	}
+}
+
+// Отпечаток - сумма вкладов вершин и ребер, поэтому при изменении графа он обновляется
+// вычитанием вклада старого ребра и добавлением вклада нового
+static uint64_t vertexHash(VertexID vid) {
+	return EdgeSet::mix(0x5645525445580000ULL ^ vid);
+}
+
+// Добавляет к хэшу h границы интервалов предиката побитно
+static uint64_t mixPredicate(uint64_t h, const Predicate &p) {
+	const std::vector<Interval> &intervals = p.intervals();
+	for (std::vector<Interval>::const_iterator i = intervals.begin(); i != intervals.end(); i++) {
+		uint64_t left, right;
+		std::memcpy(&left, &i->left, sizeof(left));
+		std::memcpy(&right, &i->right, sizeof(right));
+		h = EdgeSet::mix(h ^ left);
+		h = EdgeSet::mix(h ^ right ^ i->border);
+	}
+	return EdgeSet::mix(h ^ intervals.size());
+}
+
+uint64_t Graph::edgeHash(EdgeID e) const {
+	uint64_t h = EdgeSet::mix(e);
+	h = EdgeSet::mix(h ^ (uint64_t(vertices_[edge_from_[e]].id) << 32 | vertices_[edge_to_[e]].id));
+	return mixPredicate(h, edgePredicate(e));
+}
+
+void Graph::computeFingerprint() {
+	uint64_t h = 0;
+	for (VerticesArray::const_iterator v = vertices_.begin(); v != vertices_.end(); v++)
+		h += vertexHash(v->id);
+	for (EdgeID e = 0; e < edgesCount(); e++)
+		h += edgeHash(e);
+	fingerprint_ = h;
+}
+
+void Graph::countPredicateUses() {
+	predicate_uses_.assign(predicates_.size(), 0);
+	for (EdgeID e = 0; e < edgesCount(); e++)
+		predicate_uses_[edge_predicate_[e]]++;
+	free_predicates_.clear();
+	for (unsigned int p = 0; p < predicates_.size(); p++) {
+		if (predicate_uses_[p] == 0)
+			free_predicates_.push_back(p);
+	}
+}
+
+void Graph::buildKernels() {
+	edge_kernel_.clear();
+	edge_kernel_.reserve(edgesCount());
+	// В addEdge добавляемое ребро еще не получило номер предиката
+	for (EdgeID e = 0; e < edge_predicate_.size(); e++)
+		edge_kernel_.push_back(PredicateKernel(edgePredicate(e)));
+}
+
+unsigned int Graph::storePredicate(const Predicate &p) {
+	unsigned int k;
+	if (free_predicates_.empty()) {
+		k = static_cast<unsigned int>(predicates_.size());
+		const Predicate *data = predicates_.data();
+		predicates_.push_back(p);
+		predicate_uses_.push_back(0);
+		// Предикаты переместились: формы общего вида ссылаются на прежние адреса
+		if (predicates_.data() != data)
+			buildKernels();
+	}
+	else {
+		k = free_predicates_.back();
+		free_predicates_.pop_back();
+		predicates_[k] = p;
+	}
+	predicate_uses_[k]++;
+	return k;
+}
+
+void Graph::releasePredicate(unsigned int p) {
+	if (--predicate_uses_[p] == 0)
+		free_predicates_.push_back(p);
+}
+
+EdgeID Graph::findEdge(VertexID from, VertexID to) const {
+	std::unordered_map<VertexID, VertexIndex>::const_iterator f = indices_.find(from), t = indices_.find(to);
+	if (f == indices_.end() || t == indices_.end())
+		throw NoSuchEdge();
+	Edges out = outEdges(f->second);
+	for (Edges::const_iterator e = out.begin(); e != out.end(); e++) {
+		if (edge_to_[*e] == t->second)
+			return *e;
+	}
+	throw NoSuchEdge();
+}
+
+static bool samePredicate(const Predicate &a, const Predicate &b) {
+	const std::vector<Interval> &x = a.intervals(), &y = b.intervals();
+	if (x.size() != y.size())
+		return false;
+	for (size_t k = 0; k < x.size(); k++)
+		if (x[k].left != y[k].left || x[k].right != y[k].right || x[k].border != y[k].border)
+			return false;
+	return true;
+}
+
+struct PredicateListHash {
+	size_t operator()(const std::vector<unsigned int> &list) const {
+		uint64_t h = list.size();
+		for (std::vector<unsigned int>::const_iterator p = list.begin(); p != list.end(); p++)
+			h = EdgeSet::mix(h ^ *p);
+		return static_cast<size_t>(h);
+	}
+};
+
+// Выполняет task(k, scratch) для k из [0, count) в threads потоках; номера раздаются блоками,
+// у каждого потока свои рабочие массивы
+static void parallelFor(size_t count, unsigned threads, const std::function<void(size_t, ClassScratch&)> &task) {
+	const size_t block = 64;
+	threads = static_cast<unsigned>(std::min<size_t>(threads, (count + 4 * block - 1) / (4 * block)));
+	if (threads <= 1) {
+		ClassScratch scratch;
+		for (size_t k = 0; k < count; k++)
+			task(k, scratch);
+		return;
+	}
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; t++) {
+		workers.push_back(std::thread([&]() {
+			ClassScratch scratch;
+			for (size_t first = next.fetch_add(block); first < count; first = next.fetch_add(block))
+				for (size_t k = first; k < std::min(count, first + block); k++)
+					task(k, scratch);
+		}));
+	}
+	for (std::vector<std::thread>::iterator w = workers.begin(); w != workers.end(); w++)
+		w->join();
+}
+
+// Классы вершины зависят только от предикатов ее входящих ребер. Вершины с одинаковыми (с точностью
+// до порядка) наборами предикатов имеют одинаковые классы с точностью до номеров ребер: классы вычисляются
+// для первой из них, остальным копируются с заменой номеров. Каждая вершина изменяет только свои классы,
+// поэтому вершины обрабатываются параллельно, а результат не зависит от числа потоков.
+void Graph::computeClasses(unsigned threads) {
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	// Одинаковые по значению предикаты получают общий номер - наименьший из их номеров
+	std::vector<unsigned int> canonical(predicates_.size());
+	std::unordered_multimap<uint64_t, unsigned int> seen;
+	for (unsigned int p = 0; p < predicates_.size(); p++) {
+		const uint64_t h = mixPredicate(0, predicates_[p]);
+		canonical[p] = p;
+		typedef std::unordered_multimap<uint64_t, unsigned int>::const_iterator Iterator;
+		std::pair<Iterator, Iterator> same = seen.equal_range(h);
+		for (Iterator s = same.first; s != same.second; s++) {
+			if (samePredicate(predicates_[s->second], predicates_[p])) {
+				canonical[p] = s->second;
+				break;
+			}
 		}
+		if (canonical[p] == p)
+			seen.insert(std::make_pair(h, p));
 	}
+
+	// Входящие ребра каждой вершины, упорядоченные по общим номерам предикатов, и вершина, чьи классы копируются
+	std::vector<std::vector<EdgeID> > sorted_in(vertices_.size());
+	std::vector<VertexIndex> source(vertices_.size());
+	std::vector<VertexIndex> computed, copied;
+	std::unordered_map<std::vector<unsigned int>, VertexIndex, PredicateListHash> first_with;
+	std::vector<unsigned int> key;
+	for (VertexIndex v = 0; v < vertices_.size(); v++) {
+		Edges in = inEdges(v);
+		std::vector<EdgeID> &edges = sorted_in[v];
+		edges.assign(in.begin(), in.end());
+		std::sort(edges.begin(), edges.end(), [this, &canonical](EdgeID a, EdgeID b) {
+			return canonical[edge_predicate_[a]] < canonical[edge_predicate_[b]];
+		});
+		key.clear();
+		for (std::vector<EdgeID>::const_iterator e = edges.begin(); e != edges.end(); e++)
+			key.push_back(canonical[edge_predicate_[*e]]);
+		std::pair<std::unordered_map<std::vector<unsigned int>, VertexIndex, PredicateListHash>::iterator, bool> first =
+			first_with.insert(std::make_pair(key, v));
+		source[v] = first.first->second;
+		if (first.second)
+			computed.push_back(v);
+		else
+			copied.push_back(v);
+	}
+
+	parallelFor(computed.size(), threads, [this, &computed](size_t k, ClassScratch &scratch) {
+		vertices_[computed[k]].computeEquivalenceClasses(scratch);
+	});
+
+	const size_t edges_count = edgesCount();
+	parallelFor(copied.size(), threads, [this, &copied, &source, &sorted_in, edges_count](size_t k, ClassScratch&) {
+		const VertexIndex v = copied[k];
+		const std::vector<EdgeID> &from = sorted_in[source[v]], &to = sorted_in[v];
+		const ValueClasses &pattern = vertices_[source[v]].classes_;
+		ValueClasses &classes = vertices_[v].classes_;
+		classes.clear();
+		classes.reserve(pattern.size());
+		for (ValueClasses::const_iterator c = pattern.begin(); c != pattern.end(); c++) {
+			SatisfiedEdges se(edges_count);
+			EdgesBitset unsatisfied(edges_count);
+			for (size_t i = 0; i < from.size(); i++) {
+				if (c->edges_bitset.test(from[i]))
+					se.set(to[i]);
+				else if (c->unsatisfied_edges.test(from[i]))
+					unsatisfied.set(to[i]);
+			}
+			classes.push_back(ValueClass(c->val, std::move(se), std::move(unsatisfied)));
+		}
+	});
 }
 
-Graph::~Graph() {
-	for (Edges::iterator e = edges_.begin(); e != edges_.end(); e++) {
-		delete *e;
+void Graph::recomputeClasses(VertexIndex v) {
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	vertices_[v].computeEquivalenceClasses();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	classes_seconds_ += seconds;
+	threadStats().classesSeconds += seconds;
+}
+
+EdgeID Graph::addEdge(VertexID from, VertexID to, const Predicate &p, const ValueType &value) {
+	if (hasVertex(from) && hasVertex(to)) {
+		Edges out = outEdges(indices_.at(from));
+		for (Edges::const_iterator e = out.begin(); e != out.end(); e++) {
+			if (edge_to_[*e] == indices_.at(to))
+				throw DuplicatedEdge();
+		}
 	}
+
+	// Новые вершины: без исходящих ребер вершина доступна
+	VertexID ends[] = { from, to };
+	for (size_t k = 0; k < 2; k++) {
+		if (hasVertex(ends[k]))
+			continue;
+		VertexIndex v = addVertex(ends[k], value);
+		out_.addVertex();
+		in_.addVertex();
+		state_.unsatisfied_out.push_back(0);
+		state_.accessible.resize(vertices_.size());
+		state_.accessible.insert(v);
+		vertices_[v].computeEquivalenceClasses();
+		fingerprint_ += vertexHash(ends[k]);
+		structureChanged(StructureChange::ADD_VERTEX, 0, v, value);
+	}
+
+	const EdgeID e = static_cast<EdgeID>(edgesCount());
+	const VertexIndex f = indices_.at(from), t = indices_.at(to);
+	edge_from_.push_back(f);
+	edge_to_.push_back(t);
+	edge_predicate_.push_back(storePredicate(p));
+	edge_kernel_.push_back(PredicateKernel(edgePredicate(e)));
+	out_.insert(f, e);
+	in_.insert(t, e);
+
+	state_.satisfied.resize(edgesCount());
+	// Ребро добавляется невыполненным и при необходимости переключается, чтобы обновить доступность его начала
+	if (state_.unsatisfied_out[f]++ == 0)
+		state_.accessible.erase(f);
+	if (edge_kernel_[e].check(state_.values[t]))
+		flipEdge(state_, e);
+
+	recomputeClasses(t);
+	fingerprint_ += edgeHash(e);
+	structureChanged(StructureChange::ADD_EDGE, e, f);
+	return e;
+}
+
+void Graph::removeEdge(VertexID from, VertexID to) {
+	const EdgeID e = findEdge(from, to);
+
+	// Выполненное ребро не влияет на доступность начала, поэтому перед удалением переключаем невыполненное
+	if (!state_.satisfied[e])
+		flipEdge(state_, e);
+	fingerprint_ -= edgeHash(e);
+	const VertexIndex f = edge_from_[e], t = edge_to_[e];
+	out_.erase(edge_from_[e], e);
+	in_.erase(t, e);
+	releasePredicate(edge_predicate_[e]);
+
+	// Последнее ребро получает номер удаленного
+	const EdgeID last = static_cast<EdgeID>(edgesCount() - 1);
+	if (e != last) {
+		fingerprint_ -= edgeHash(last);
+		edge_from_[e] = edge_from_[last];
+		edge_to_[e] = edge_to_[last];
+		edge_predicate_[e] = edge_predicate_[last];
+		edge_kernel_[e] = edge_kernel_[last];
+		state_.satisfied.set(e, state_.satisfied[last]);
+		out_.renumber(edge_from_[e], last, e);
+		in_.renumber(edge_to_[e], last, e);
+		ValueClasses &classes = vertices_[edge_to_[e]].classes_;
+		for (ValueClasses::iterator c = classes.begin(); c != classes.end(); c++) {
+			c->edges_bitset.set(e, c->edges_bitset[last]);
+			c->edges_bitset.reset(last);
+			c->unsatisfied_edges.set(e, c->unsatisfied_edges[last]);
+			c->unsatisfied_edges.reset(last);
+		}
+		fingerprint_ += edgeHash(e);
+	}
+	edge_from_.pop_back();
+	edge_to_.pop_back();
+	edge_predicate_.pop_back();
+	edge_kernel_.pop_back();
+	state_.satisfied.resize(edgesCount());
+
+	recomputeClasses(t);
+	structureChanged(StructureChange::REMOVE_EDGE, e, f);
+}
+
+void Graph::replacePredicate(VertexID from, VertexID to, const Predicate &p) {
+	const EdgeID e = findEdge(from, to);
+
+	fingerprint_ -= edgeHash(e);
+	releasePredicate(edge_predicate_[e]);
+	edge_predicate_[e] = storePredicate(p);
+	edge_kernel_[e] = PredicateKernel(edgePredicate(e));
+	fingerprint_ += edgeHash(e);
+
+	const VertexIndex t = edge_to_[e];
+	if (edge_kernel_[e].check(state_.values[t]) != state_.satisfied[e])
+		flipEdge(state_, e);
+	recomputeClasses(t);
+	structureChanged(StructureChange::REPLACE_PREDICATE, e, t);
+}
+
+void Graph::structureChanged(StructureChange::Kind kind, EdgeID edge, VertexIndex vertex, const ValueType &value) {
+	changes_.push_back({ kind, edge, vertex, value });
+	state_.version = changes_.size();
+	// Переключения ребер, записанные в журнале, относятся к прежней нумерации
+	if (!state_.undo.records.empty()) {
+		state_.undo.reevaluate_end = state_.undo.records.size();
+		state_.undo.flipped_edges.clear();
+	}
+}
+
+void Graph::update(GraphState &state) const {
+	if (state.version == changes_.size())
+		return;
+	// Ребра, выполненность которых надо вычислить заново: добавленные и с новым предикатом.
+	// Номера в touched могут устареть при удалении ребер; действителен номер, отмеченный в dirty.
+	EdgesBitset dirty(state.satisfied.size());
+	std::vector<EdgeID> touched;
+	for (size_t k = state.version; k < changes_.size(); k++) {
+		const StructureChange &c = changes_[k];
+		switch (c.kind) {
+		case StructureChange::ADD_VERTEX:
+			state.values.push_back(c.value);
+			state.unsatisfied_out.push_back(0);
+			state.accessible.resize(state.values.size());
+			state.accessible.insert(c.vertex);
+			break;
+		case StructureChange::ADD_EDGE:
+			// Как и в addEdge(), ребро добавляется невыполненным
+			state.satisfied.resize(c.edge + 1);
+			dirty.resize(c.edge + 1);
+			dirty.set(c.edge);
+			touched.push_back(c.edge);
+			if (state.unsatisfied_out[c.vertex]++ == 0)
+				state.accessible.erase(c.vertex);
+			break;
+		case StructureChange::REMOVE_EDGE: {
+			const EdgeID last = static_cast<EdgeID>(state.satisfied.size() - 1);
+			if (!state.satisfied[c.edge] && --state.unsatisfied_out[c.vertex] == 0)
+				state.accessible.insert(c.vertex);
+			state.satisfied.set(c.edge, state.satisfied[last]);
+			dirty.set(c.edge, dirty[last]);
+			if (dirty[last])
+				touched.push_back(c.edge);
+			state.satisfied.resize(last);
+			dirty.resize(last);
+			break;
+		}
+		case StructureChange::REPLACE_PREDICATE:
+			dirty.set(c.edge);
+			touched.push_back(c.edge);
+			break;
+		}
+	}
+	for (std::vector<EdgeID>::const_iterator e = touched.begin(); e != touched.end(); e++) {
+		if (*e >= dirty.size() || !dirty[*e])
+			continue;
+		dirty.reset(*e);
+		if (edge_kernel_[*e].check(state.values[edge_to_[*e]]) != state.satisfied[*e])
+			flipEdge(state, *e);
+	}
+	if (!state.undo.records.empty()) {
+		state.undo.reevaluate_end = state.undo.records.size();
+		state.undo.flipped_edges.clear();
+	}
+	state.version = changes_.size();
+}
+
+Graph::~Graph() {
 }
 
 ValueType Graph::setValue(VertexID vid, const ValueType &val) {
-	Vertex& v = vertices_.at(vid);
-	ValueType old_value = v.value();
+	return setValue(state_, vid, val);
+}
+
+ValueType Graph::setValue(GraphState &state, VertexID vid, const ValueType &val) const {
+	const VertexIndex v = indices_.at(vid);
 
-	if (!v.accessible_)
+	threadStats().setValueCalls++;
+	update(state);
+	if (!state.accessible.contains(v))
 		throw Inaccessible();
-	v.val_ = val;
-	for (Edges::iterator it = v.in_.begin(); it != v.in_.end(); it++) {
-		Edge *e = *it;
-		e->satisfied = e->p->check(v.val_);
-		currentClass_[e->seq] = e->satisfied;
-		if (!e->satisfied) {
-			e->from->changeAccessibility(false);
-		}
-		else {
-			e->from->changeAccessibility(e->from->checkAccessibility());
+	return assignValue(state, v, val);
+}
+
+ValueType Graph::overrideValue(GraphState &state, VertexID vid, const ValueType &val) const {
+	update(state);
+	return assignValue(state, indices_.at(vid), val);
+}
+
+ValueType Graph::assignValue(GraphState &state, VertexIndex v, const ValueType &val) const {
+	ValueType old_value = state.values[v];
+	state.values[v] = val;
+	size_t flipped = 0;
+	Edges in = inEdges(v);
+	for (Edges::const_iterator e = in.begin(); e != in.end(); e++) {
+		if (edge_kernel_[*e].check(val) == state.satisfied[*e])
+			continue;
+		flipEdge(state, *e);
+		if (state.undo.enabled) {
+			state.undo.flipped_edges.push_back(*e);
+			flipped++;
 		}
 	}
+	if (state.undo.enabled)
+		state.undo.records.push_back({ v, old_value, flipped });
 
 	return old_value;
 }
 
-void Graph::toggleVertexAccessibility(VertexID vid, bool accessibility) {
-	if (accessibility)
-		accessibleVertices_.insert(vid);
-	else
-		accessibleVertices_.erase(vid);
+void Graph::flipEdge(GraphState &state, EdgeID e) const {
+	// Доступность начала ребра меняется только при изменении выполненности ребра;
+	// счетчик невыполненных исходящих ребер позволяет обновить ее за O(1)
+	bool satisfied = !state.satisfied[e];
+	state.satisfied.set(e, satisfied);
+	VertexIndex from = edge_from_[e];
+	if (satisfied) {
+		if (--state.unsatisfied_out[from] == 0)
+			state.accessible.insert(from);
+	}
+	else {
+		if (state.unsatisfied_out[from]++ == 0)
+			state.accessible.erase(from);
+	}
+}
+
+Graph::Checkpoint Graph::checkpoint(GraphState &state) const {
+	update(state);
+	state.undo.enabled = true;
+	return state.undo.records.size();
+}
+
+void Graph::rollback(GraphState &state, Checkpoint mark) const {
+	update(state);
+	UndoLog &undo = state.undo;
+	while (undo.records.size() > mark) {
+		const UndoLog::Record &r = undo.records.back();
+		if (undo.records.size() <= undo.reevaluate_end) {
+			// Запись сделана до изменения структуры: выполненность входящих ребер вычисляется заново
+			Edges in = inEdges(r.vertex);
+			for (Edges::const_iterator e = in.begin(); e != in.end(); e++)
+				if (edge_kernel_[*e].check(r.old_value) != state.satisfied[*e])
+					flipEdge(state, *e);
+		}
+		else {
+			for (size_t k = 0; k < r.flipped; k++) {
+				flipEdge(state, undo.flipped_edges.back());
+				undo.flipped_edges.pop_back();
+			}
+		}
+		state.values[r.vertex] = r.old_value;
+		undo.records.pop_back();
+	}
+	undo.reevaluate_end = std::min(undo.reevaluate_end, undo.records.size());
 }
 
+void Graph::commit(GraphState &state) const {
+	state.undo.enabled = false;
+	state.undo.records.clear();
+	state.undo.flipped_edges.clear();
+	state.undo.reevaluate_end = 0;
+}
 
 std::ostream& operator<<(std::ostream& os, const Graph& g) {
 	os << "Graph " << g.vertices_.size() << " vertices.";
 	os << "\tAccessible: ";
-	for (std::set<VertexID>::const_iterator v = g.accessibleVertices_.begin(); v != g.accessibleVertices_.end(); v++) {
-		if (v != g.accessibleVertices_.begin())
+	for (AccessibleSet::const_iterator v = g.accessibleVertices().begin(); v != g.accessibleVertices().end(); v++) {
+		if (v != g.accessibleVertices().begin())
 			os << ", ";
-		os << *v;
+		os << g.vertexAt(*v).id;
 	}
 	return os;
 }
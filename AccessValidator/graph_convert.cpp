@@ -0,0 +1,147 @@
+﻿// graph_convert.cpp : преобразование текстового описания графа в двоичный формат (graph_file.h).
+//
+// Текстовый формат, по одной записи в строке; '#' начинает комментарий:
+//   v <вершина> <значение>          начальное значение вершины (по умолчанию 0)
+//   p <интервал> <интервал> ...     предикат; предикаты нумеруются по порядку, начиная с 0.
+//                                   Интервал - [a b], [a b), (a b] или (a b); границы могут быть inf и -inf.
+//                                   Предикат без интервалов тождественно ложен.
+//   e <начало> <конец> <предикат>   ребро
+//
+// Пример:
+//   p [0 1]
+//   p (-inf -4] (6 inf)
+//   v 1 0.5
+//   e 0 1 0
+//   e 2 0 1
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cctype>
+#include <stdexcept>
+
+#include "AccessValidator.h"
+#include "graph_file.h"
+
+// Ошибка в текстовом описании
+struct ParseError {
+	size_t line;
+	std::string reason;
+};
+
+static void skipSpaces(const char *&p) {
+	while (*p && std::isspace(static_cast<unsigned char>(*p)))
+		p++;
+}
+
+// Разбор интервалов предиката из оставшейся части строки
+static Predicate parsePredicate(const char *p, size_t line) {
+	Predicate predicate;
+	predicate.clear();
+	for (skipSpaces(p); *p; skipSpaces(p)) {
+		Interval interval;
+		if (*p != '[' && *p != '(')
+			throw ParseError({ line, "interval must start with '[' or '('" });
+		bool left_closed = *p++ == '[';
+		char *end;
+		interval.left = std::strtod(p, &end);
+		if (end == p)
+			throw ParseError({ line, "bad left border" });
+		p = end;
+		skipSpaces(p);
+		if (*p == ',')
+			p++;
+		interval.right = std::strtod(p, &end);
+		if (end == p)
+			throw ParseError({ line, "bad right border" });
+		p = end;
+		skipSpaces(p);
+		if (*p != ']' && *p != ')')
+			throw ParseError({ line, "interval must end with ']' or ')'" });
+		bool right_closed = *p++ == ']';
+		interval.border = Interval::BorderType((left_closed ? Interval::LEFT_CLOSED : 0) | (right_closed ? Interval::RIGHT_CLOSED : 0));
+		predicate.addInterval(interval);
+	}
+	return predicate;
+}
+
+static void readText(std::istream &is, std::vector<edge_info> &edges, VerticesValues &values, std::vector<Predicate> &predicates) {
+	std::string text;
+	for (size_t line = 1; std::getline(is, text); line++) {
+		text = text.substr(0, text.find('#'));
+		std::istringstream ls(text);
+		std::string kind;
+		if (!(ls >> kind))
+			continue;
+		if (kind == "v") {
+			VertexID vid;
+			std::string value;
+			if (!(ls >> vid >> value))
+				throw ParseError({ line, "expected: v <vertex> <value>" });
+			values[vid] = std::strtod(value.c_str(), 0);
+		}
+		else if (kind == "p") {
+			predicates.push_back(parsePredicate(text.c_str() + text.find('p') + 1, line));
+		}
+		else if (kind == "e") {
+			edge_info e;
+			if (!(ls >> e.from >> e.to >> e.predicate))
+				throw ParseError({ line, "expected: e <from> <to> <predicate>" });
+			if (e.predicate < 0)
+				throw ParseError({ line, "negative predicate number" });
+			edges.push_back(e);
+		}
+		else
+			throw ParseError({ line, "unknown record '" + kind + "'" });
+	}
+}
+
+int main(int argc, char *argv[]) {
+	bool with_classes = true;
+	std::vector<std::string> files;
+	for (int k = 1; k < argc; k++) {
+		if (std::string(argv[k]) == "--no-classes")
+			with_classes = false;
+		else
+			files.push_back(argv[k]);
+	}
+	if (files.size() != 2) {
+		std::cerr << "Usage: graph_convert [--no-classes] <input.txt> <output.avg>" << std::endl;
+		return 1;
+	}
+
+	std::ifstream input(files[0].c_str());
+	if (!input) {
+		std::cerr << "Cannot open " << files[0] << std::endl;
+		return 1;
+	}
+	std::vector<edge_info> edges;
+	VerticesValues values;
+	std::vector<Predicate> predicates;
+	try {
+		readText(input, edges, values, predicates);
+		Graph g(edges, values, predicates);
+		writeGraphFile(g, files[1], with_classes);
+		std::cout << g.vertices().size() << " vertices, " << g.edgesCount() << " edges" << std::endl;
+	}
+	catch (const ParseError &e) {
+		std::cerr << files[0] << ":" << e.line << ": " << e.reason << std::endl;
+		return 1;
+	}
+	catch (const BadGraphFile &e) {
+		std::cerr << e.reason << std::endl;
+		return 1;
+	}
+	catch (const DuplicatedEdge&) {
+		std::cerr << "Duplicated edge" << std::endl;
+		return 1;
+	}
+	catch (const std::out_of_range&) {
+		std::cerr << "Edge refers to undefined predicate" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,353 @@
+﻿#include <fstream>
+#include <vector>
+#include <cstring>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "AccessValidator.h"
+#include "graph_file.h"
+
+static_assert(sizeof(VertexID) == 4 && sizeof(VertexIndex) == 4 && sizeof(EdgeID) == 4,
+	"graph file stores vertex and edge numbers as uint32");
+static_assert(sizeof(ValueType) == 8, "graph file stores values as double");
+static_assert(sizeof(GraphFileHeader) % 8 == 0, "sections must stay 8-byte aligned");
+
+static const char graph_file_magic[8] = { 'A', 'V', 'G', 'R', 'A', 'P', 'H', 0 };
+
+static size_t align8(size_t n) {
+	return (n + 7) & ~size_t(7);
+}
+
+//
+// Отображение в память
+//
+
+GraphFile::GraphFile(const std::string &path)
+	: data_(0), size_(0), mapping_(0)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		throw BadGraphFile("cannot open " + path);
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	size_ = static_cast<size_t>(file_size.QuadPart);
+	HANDLE mapping = size_ ? CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0) : 0;
+	CloseHandle(file);
+	if (mapping) {
+		data_ = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		mapping_ = mapping;
+	}
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw BadGraphFile("cannot open " + path);
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		size_ = static_cast<size_t>(st.st_size);
+		void *p = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED)
+			data_ = static_cast<const char*>(p);
+	}
+	close(fd);
+#endif
+	if (!data_) {
+		unmap();
+		throw BadGraphFile("cannot map " + path);
+	}
+	try {
+		layout();
+	}
+	catch (...) {
+		unmap();
+		throw;
+	}
+}
+
+GraphFile::~GraphFile() {
+	unmap();
+}
+
+void GraphFile::unmap() {
+#ifdef _WIN32
+	if (data_)
+		UnmapViewOfFile(data_);
+	if (mapping_)
+		CloseHandle(static_cast<HANDLE>(mapping_));
+#else
+	if (data_)
+		munmap(const_cast<char*>(data_), size_);
+#endif
+	data_ = 0;
+	mapping_ = 0;
+}
+
+void GraphFile::layout() {
+	if (size_ < sizeof(GraphFileHeader))
+		throw BadGraphFile("file is too short");
+	const GraphFileHeader &h = header();
+	if (std::memcmp(h.magic, graph_file_magic, sizeof(graph_file_magic)) != 0)
+		throw BadGraphFile("not a graph file");
+	if (h.byte_order != graph_file_byte_order)
+		throw BadGraphFile("graph file was written with another byte order");
+	if (h.version != graph_file_version)
+		throw BadGraphFile("unsupported graph file version");
+
+	// Размеры секций считаются в 64-битной арифметике, чтобы большие счетчики из поврежденного
+	// заголовка не могли переполнить смещения
+	const uint64_t v = h.vertices, e = h.edges;
+	uint64_t offset = sizeof(GraphFileHeader);
+	uint64_t limit = size_;
+	auto section = [&offset, limit](uint64_t count, uint64_t item_size) -> size_t {
+		if (count > limit / item_size || offset + count * item_size > limit)
+			throw BadGraphFile("graph file is truncated");
+		size_t start = static_cast<size_t>(offset);
+		offset = align8(static_cast<size_t>(offset + count * item_size));
+		return start;
+	};
+	vertex_ids_ = section(v, sizeof(uint32_t));
+	vertex_values_ = section(v, sizeof(double));
+	edge_from_ = section(e, sizeof(uint32_t));
+	edge_to_ = section(e, sizeof(uint32_t));
+	edge_predicate_ = section(e, sizeof(uint32_t));
+	out_offsets_ = section(v + 1, sizeof(uint32_t));
+	out_edges_ = section(e, sizeof(uint32_t));
+	in_offsets_ = section(v + 1, sizeof(uint32_t));
+	in_edges_ = section(e, sizeof(uint32_t));
+	pred_offsets_ = section(uint64_t(h.predicates) + 1, sizeof(uint32_t));
+	intervals_ = section(h.intervals, sizeof(GraphFileInterval));
+	class_offsets_ = class_values_ = class_words_ = static_cast<size_t>(offset);
+	if (hasClasses()) {
+		class_offsets_ = section(v + 1, sizeof(uint32_t));
+		class_values_ = section(h.classes, sizeof(double));
+		class_words_ = section(h.class_words, sizeof(uint64_t));
+	}
+}
+
+//
+// Построение графа по файлу
+//
+
+// Массив смещений непрерывно делит [0, total) на части
+static bool validOffsets(const uint32_t *offsets, size_t parts, uint64_t total) {
+	if (offsets[0] != 0 || offsets[parts] != total)
+		return false;
+	for (size_t k = 0; k < parts; k++)
+		if (offsets[k] > offsets[k + 1])
+			return false;
+	return true;
+}
+
+static bool allBelow(const uint32_t *values, size_t n, uint64_t bound) {
+	for (size_t k = 0; k < n; k++)
+		if (values[k] >= bound)
+			return false;
+	return true;
+}
+
+// Списки смежности согласованы с концами ребер ends (началами для исходящих, концами для входящих):
+// в списке вершины v только ребра с концом v, и каждое ребро встречается один раз.
+// Смещения уже проверены (validOffsets), поэтому всего в списках edges_count ребер и каждое ребро входит ровно в один.
+static bool consistentAdjacency(const uint32_t *offsets, const uint32_t *edges, const uint32_t *ends,
+		size_t vertices_count, size_t edges_count) {
+	std::vector<bool> seen(edges_count, false);
+	for (size_t v = 0; v < vertices_count; v++)
+		for (uint32_t k = offsets[v]; k < offsets[v + 1]; k++) {
+			const uint32_t e = edges[k];
+			if (ends[e] != v || seen[e])
+				return false;
+			seen[e] = true;
+		}
+	return true;
+}
+
+// Массивы переносятся из отображения целиком, без разбора отдельных элементов. Проверяются границы номеров,
+// чтобы поврежденный файл не приводил к выходу за пределы массивов, и согласованность списков смежности
+// с началами и концами ребер: по началам считаются доступные вершины, а по спискам идет перебор.
+Graph::Graph(const GraphFile &file, unsigned threads) {
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const GraphFileHeader &h = file.header();
+	const size_t vertices_count = h.vertices, edges_count = h.edges;
+
+	if (!allBelow(file.edgeFrom(), edges_count, vertices_count) || !allBelow(file.edgeTo(), edges_count, vertices_count)
+		|| !allBelow(file.edgePredicate(), edges_count, h.predicates)
+		|| !validOffsets(file.outOffsets(), vertices_count, edges_count) || !allBelow(file.outEdges(), edges_count, edges_count)
+		|| !validOffsets(file.inOffsets(), vertices_count, edges_count) || !allBelow(file.inEdges(), edges_count, edges_count)
+		|| !validOffsets(file.predicateOffsets(), h.predicates, h.intervals)
+		|| !consistentAdjacency(file.outOffsets(), file.outEdges(), file.edgeFrom(), vertices_count, edges_count)
+		|| !consistentAdjacency(file.inOffsets(), file.inEdges(), file.edgeTo(), vertices_count, edges_count))
+		throw BadGraphFile("graph file is corrupted");
+
+	vertices_.reserve(vertices_count);
+	indices_.reserve(vertices_count);
+	for (VertexIndex v = 0; v < vertices_count; v++) {
+		if (!indices_.insert(std::make_pair(file.vertexIds()[v], v)).second)
+			throw BadGraphFile("graph file contains duplicated vertex");
+		vertices_.push_back(Vertex(this, file.vertexIds()[v], v));
+	}
+	state_.values.assign(file.vertexValues(), file.vertexValues() + vertices_count);
+
+	edge_from_.assign(file.edgeFrom(), file.edgeFrom() + edges_count);
+	edge_to_.assign(file.edgeTo(), file.edgeTo() + edges_count);
+	edge_predicate_.assign(file.edgePredicate(), file.edgePredicate() + edges_count);
+	out_.assign(file.outOffsets(), file.outEdges(), vertices_count);
+	in_.assign(file.inOffsets(), file.inEdges(), vertices_count);
+	try {
+		checkDuplicatedEdges();
+	}
+	catch (const DuplicatedEdge&) {
+		throw BadGraphFile("graph file contains duplicated edge");
+	}
+
+	// Интервалы в файле записаны нормализованными (Predicate::intervals()), поэтому вместо нормализации
+	// только проверяется их упорядоченность
+	predicates_.reserve(h.predicates);
+	std::vector<Interval> intervals;
+	for (size_t p = 0; p < h.predicates; p++) {
+		intervals.clear();
+		for (uint32_t k = file.predicateOffsets()[p]; k < file.predicateOffsets()[p + 1]; k++) {
+			const GraphFileInterval &i = file.intervals()[k];
+			intervals.push_back({ i.left, i.right, Interval::BorderType(i.border & Interval::DOUBLE_CLOSED) });
+		}
+		if (!Predicate::isNormalized(intervals))
+			throw BadGraphFile("graph file contains unordered predicate intervals");
+		predicates_.push_back(Predicate::fromNormalized(intervals));
+	}
+
+	countPredicateUses();
+	buildKernels();
+	initState();
+	computeFingerprint();
+
+	if (!file.hasClasses()) {
+		const std::chrono::steady_clock::time_point classes_start = std::chrono::steady_clock::now();
+		computeClasses(threads);
+		recordBuildTime(start, classes_start);
+		return;
+	}
+	if (!validOffsets(file.classOffsets(), vertices_count, h.classes))
+		throw BadGraphFile("graph file is corrupted");
+	uint64_t word = 0;
+	for (VerticesArray::iterator v = vertices_.begin(); v != vertices_.end(); v++) {
+		const Edges in = v->predecessors();
+		const size_t words = EdgeSet::wordsFor(in.size());
+		EdgesBitset incoming_bitset(edges_count);
+		for (size_t k = 0; k < in.size(); k++)
+			incoming_bitset.set(in[k]);
+		for (uint32_t c = file.classOffsets()[v->index_]; c < file.classOffsets()[v->index_ + 1]; c++) {
+			if (word + words > h.class_words)
+				throw BadGraphFile("graph file is corrupted");
+			const uint64_t *local = file.classWords() + word;
+			word += words;
+			SatisfiedEdges se(edges_count);
+			for (size_t k = 0; k < in.size(); k++) {
+				if ((local[k / EdgeSet::word_bits] >> (k % EdgeSet::word_bits)) & 1)
+					se.set(in[k]);
+			}
+			EdgesBitset unsatisfied = incoming_bitset;
+			unsatisfied.andNot(se);
+			v->classes_.push_back(ValueClass(file.classValues()[c], se, unsatisfied));
+		}
+	}
+	// Классы прочитаны из файла и входят во время построения
+	recordBuildTime(start, std::chrono::steady_clock::now());
+}
+
+//
+// Запись
+//
+
+template<class T>
+static void writeArray(std::ofstream &os, const T *data, size_t n) {
+	if (n)
+		os.write(reinterpret_cast<const char*>(data), n * sizeof(T));
+	static const char zeros[8] = { 0 };
+	os.write(zeros, align8(n * sizeof(T)) - n * sizeof(T));
+}
+
+template<class T>
+static void writeArray(std::ofstream &os, const std::vector<T> &data) {
+	writeArray(os, data.data(), data.size());
+}
+
+void writeGraphFile(const Graph &g, const std::string &path, bool with_classes) {
+	std::vector<uint32_t> ids;
+	for (Graph::VerticesArray::const_iterator v = g.vertices_.begin(); v != g.vertices_.end(); v++)
+		ids.push_back(v->id);
+
+	std::vector<uint32_t> pred_offsets(1, 0);
+	std::vector<GraphFileInterval> intervals;
+	for (std::vector<Predicate>::const_iterator p = g.predicates_.begin(); p != g.predicates_.end(); p++) {
+		for (std::vector<Interval>::const_iterator i = p->intervals().begin(); i != p->intervals().end(); i++)
+			intervals.push_back({ i->left, i->right, static_cast<uint32_t>(i->border), 0 });
+		pred_offsets.push_back(static_cast<uint32_t>(intervals.size()));
+	}
+
+	// Классы хранятся в виде множеств входящих ребер вершины, а не всех ребер графа
+	std::vector<uint32_t> class_offsets(1, 0);
+	std::vector<double> class_values;
+	std::vector<uint64_t> class_words;
+	if (with_classes) {
+		for (Graph::VerticesArray::const_iterator v = g.vertices_.begin(); v != g.vertices_.end(); v++) {
+			const Edges in = v->predecessors();
+			const ValueClasses &classes = v->equivalenceClasses();
+			for (ValueClasses::const_iterator c = classes.begin(); c != classes.end(); c++) {
+				class_values.push_back(c->val);
+				size_t first = class_words.size();
+				class_words.resize(first + EdgeSet::wordsFor(in.size()), 0);
+				for (size_t k = 0; k < in.size(); k++) {
+					if (c->edges_bitset[in[k]])
+						class_words[first + k / EdgeSet::word_bits] |= uint64_t(1) << (k % EdgeSet::word_bits);
+				}
+			}
+			class_offsets.push_back(static_cast<uint32_t>(class_values.size()));
+		}
+	}
+
+	GraphFileHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, graph_file_magic, sizeof(h.magic));
+	h.version = graph_file_version;
+	h.byte_order = graph_file_byte_order;
+	h.flags = with_classes ? GraphFileHeader::HAS_CLASSES : 0;
+	h.vertices = static_cast<uint32_t>(g.vertices_.size());
+	h.edges = static_cast<uint32_t>(g.edgesCount());
+	h.predicates = static_cast<uint32_t>(g.predicates_.size());
+	h.intervals = intervals.size();
+	h.classes = class_values.size();
+	h.class_words = class_words.size();
+
+	std::ofstream os(path.c_str(), std::ios::binary | std::ios::trunc);
+	if (!os)
+		throw BadGraphFile("cannot create " + path);
+	writeArray(os, &h, 1);
+	writeArray(os, ids);
+	writeArray(os, g.state_.values);
+	writeArray(os, g.edge_from_);
+	writeArray(os, g.edge_to_);
+	writeArray(os, g.edge_predicate_);
+	std::vector<EdgeID> offsets, edges;
+	g.out_.exportCSR(offsets, edges);
+	writeArray(os, offsets);
+	writeArray(os, edges);
+	g.in_.exportCSR(offsets, edges);
+	writeArray(os, offsets);
+	writeArray(os, edges);
+	writeArray(os, pred_offsets);
+	writeArray(os, intervals);
+	if (with_classes) {
+		writeArray(os, class_offsets);
+		writeArray(os, class_values);
+		writeArray(os, class_words);
+	}
+	if (!os)
+		throw BadGraphFile("cannot write " + path);
+}
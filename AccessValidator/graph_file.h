@@ -0,0 +1,106 @@
+﻿#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "AccessValidator.h"
+
+// Двоичный формат графа.
+//
+// Файл начинается с заголовка GraphFileHeader, за ним следуют секции (каждая выровнена на 8 байт):
+//   vertex_ids      uint32[vertices]       номера вершин (VertexID) в порядке VertexIndex
+//   vertex_values   double[vertices]       начальные значения
+//   edge_from       uint32[edges]          начало ребра (VertexIndex)
+//   edge_to         uint32[edges]          конец ребра (VertexIndex)
+//   edge_predicate  uint32[edges]          номер предиката
+//   out_offsets     uint32[vertices + 1]   CSR исходящих ребер
+//   out_edges       uint32[edges]
+//   in_offsets      uint32[vertices + 1]   CSC входящих ребер
+//   in_edges        uint32[edges]
+//   pred_offsets    uint32[predicates + 1] интервалы предиката p - intervals[pred_offsets[p] .. pred_offsets[p + 1])
+//   intervals       GraphFileInterval[intervals]
+// Если установлен флаг HAS_CLASSES, далее записаны классы эквивалентности значений вершин:
+//   class_offsets   uint32[vertices + 1]   классы вершины v - с номерами class_offsets[v] .. class_offsets[v + 1]
+//   class_values    double[classes]        представители классов
+//   class_words     uint64[class_words]    выполненные входящие ребра каждого класса; бит k - k-е входящее ребро вершины,
+//                                          на класс приходится EdgeSet::wordsFor(число входящих ребер) слов
+// Числа записываются в порядке байт машины, создавшей файл; он проверяется по полю byte_order.
+
+static const uint32_t graph_file_version = 1;
+
+struct GraphFileHeader {
+	char magic[8]; // "AVGRAPH"
+	uint32_t version;
+	uint32_t byte_order; // graph_file_byte_order в порядке байт записавшей машины
+	uint32_t flags;
+	uint32_t vertices;
+	uint32_t edges;
+	uint32_t predicates;
+	uint64_t intervals;
+	uint64_t classes;
+	uint64_t class_words;
+
+	enum Flags { HAS_CLASSES = 1 };
+};
+
+static const uint32_t graph_file_byte_order = 0x01020304;
+
+// Интервалы предиката записываются так, как их хранит Predicate: упорядоченными и без пересечений
+struct GraphFileInterval {
+	double left;
+	double right;
+	uint32_t border; // Interval::BorderType
+	uint32_t reserved;
+};
+
+// Файл поврежден, имеет другую версию или не может быть прочитан
+class BadGraphFile : public Error {
+public:
+	std::string reason;
+	explicit BadGraphFile(const std::string &r) : reason(r) {}
+};
+
+// Файл графа, отображенный в память только для чтения. Размеры секций проверяются при открытии;
+// содержимое проверяется при построении Graph(const GraphFile&). После построения графа файл можно закрыть.
+class GraphFile {
+	const char *data_;
+	size_t size_;
+	void *mapping_; // Платформенный дескриптор отображения
+
+	// Смещения секций от начала файла
+	size_t vertex_ids_, vertex_values_, edge_from_, edge_to_, edge_predicate_;
+	size_t out_offsets_, out_edges_, in_offsets_, in_edges_, pred_offsets_, intervals_;
+	size_t class_offsets_, class_values_, class_words_;
+
+	GraphFile(const GraphFile&);
+	GraphFile& operator=(const GraphFile&);
+
+	template<class T> const T* at(size_t offset) const { return reinterpret_cast<const T*>(data_ + offset); }
+	void layout(); // Вычисляет смещения секций и сверяет их с размером файла
+	void unmap();
+public:
+	explicit GraphFile(const std::string &path);
+	~GraphFile();
+
+	const GraphFileHeader& header() const { return *at<GraphFileHeader>(0); }
+	bool hasClasses() const { return (header().flags & GraphFileHeader::HAS_CLASSES) != 0; }
+
+	const uint32_t* vertexIds() const { return at<uint32_t>(vertex_ids_); }
+	const double* vertexValues() const { return at<double>(vertex_values_); }
+	const uint32_t* edgeFrom() const { return at<uint32_t>(edge_from_); }
+	const uint32_t* edgeTo() const { return at<uint32_t>(edge_to_); }
+	const uint32_t* edgePredicate() const { return at<uint32_t>(edge_predicate_); }
+	const uint32_t* outOffsets() const { return at<uint32_t>(out_offsets_); }
+	const uint32_t* outEdges() const { return at<uint32_t>(out_edges_); }
+	const uint32_t* inOffsets() const { return at<uint32_t>(in_offsets_); }
+	const uint32_t* inEdges() const { return at<uint32_t>(in_edges_); }
+	const uint32_t* predicateOffsets() const { return at<uint32_t>(pred_offsets_); }
+	const GraphFileInterval* intervals() const { return at<GraphFileInterval>(intervals_); }
+	const uint32_t* classOffsets() const { return at<uint32_t>(class_offsets_); }
+	const double* classValues() const { return at<double>(class_values_); }
+	const uint64_t* classWords() const { return at<uint64_t>(class_words_); }
+};
+
+// Записывает граф (без текущего состояния, кроме значений вершин) в двоичный файл.
+// with_classes - сохранить классы эквивалентности, чтобы не вычислять их при загрузке.
+void writeGraphFile(const Graph &g, const std::string &path, bool with_classes = true);
@@ -0,0 +1,193 @@
+﻿#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include "AccessValidator.h"
+#include "search.h"
+#include "utils.h"
+#include "trace.h"
+
+// Цепочка изменений от корня перебора; общие префиксы разделяются между задачами
+struct TraceNode {
+	Solver::UpdateInfo change;
+	std::shared_ptr<const TraceNode> parent;
+};
+
+// Задача перебора: состояние графа, переходы из которого еще не рассмотрены
+struct SearchTask {
+	GraphState state;
+	std::shared_ptr<const TraceNode> trace;
+};
+
+// Очередь задач одного потока. Владелец работает с концом очереди (обход в глубину),
+// остальные потоки забирают задачи из начала, где лежат состояния ближе к корню.
+class WorkStealingDeque {
+	std::mutex mutex_;
+	std::deque<SearchTask> tasks_;
+public:
+	void push(SearchTask &&task) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		tasks_.push_back(std::move(task));
+	}
+	bool pop(SearchTask &task) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (tasks_.empty())
+			return false;
+		task = std::move(tasks_.back());
+		tasks_.pop_back();
+		return true;
+	}
+	bool steal(SearchTask &task) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (tasks_.empty())
+			return false;
+		task = std::move(tasks_.front());
+		tasks_.pop_front();
+		return true;
+	}
+};
+
+// Множество просмотренных классов эквивалентности, разбитое на независимо блокируемые части
+class ConcurrentHistory {
+	struct Shard {
+		std::mutex mutex;
+		std::unordered_set<EquivalenceClass> classes;
+	};
+	std::vector<Shard> shards_;
+public:
+	explicit ConcurrentHistory(size_t shards) : shards_(shards) {}
+
+	// Возвращает true, если класс ранее не встречался
+	bool insert(const EquivalenceClass &c) {
+		size_t h = c.hash();
+		Shard &shard = shards_[(h ^ (h >> 16)) % shards_.size()];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		return shard.classes.insert(c).second;
+	}
+};
+
+bool Solver::parallelSolver(const Graph &g, VertexID target, unsigned threads) {
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	this->trace = std::stack<UpdateInfo>();
+	this->statesExpanded = 0;
+	this->historyBytes = 0;
+	this->stopReason = NOT_STOPPED;
+	this->outcome = INACCESSIBLE;
+	StatsScope stats_scope(*this, g);
+	if (!g.hasVertex(target))
+		return false;
+	if (g.isAccessible(target)) {
+		outcome = ACCESSIBLE;
+		return true;
+	}
+	const VertexIndex target_index = g.vertex(target).index();
+
+	const TargetInfluence influence = computeInfluence(g, target); // Классы эквивалентности храним только на влияющих ребрах
+	ConcurrentHistory classes_history(16 * threads);
+	std::vector<WorkStealingDeque> queues(threads);
+	std::atomic<size_t> pending(1); // Задачи, которые добавлены в очереди, но еще не раскрыты до конца
+	std::atomic<size_t> expanded(0);
+	std::atomic<bool> found(false); // Первый поток, получивший доступ, останавливает остальные
+	std::atomic<size_t> history_bytes(0);
+	std::atomic<int> stop(NOT_STOPPED); // Первое сработавшее ограничение тоже останавливает все потоки
+	std::mutex witness_mutex;
+	std::shared_ptr<const TraceNode> witness;
+
+	EquivalenceClass initial_class = g.equivalenceClass();
+	influence.restrict(initial_class);
+	classes_history.insert(initial_class);
+	history_bytes += stateBytes(initial_class);
+	queues[0].push(SearchTask({ g.state(), std::shared_ptr<const TraceNode>() }));
+
+	auto worker = [&](unsigned self) {
+		SearchTask task;
+		SearchBudget budget(options);
+		SolverStats &counters = threadStats();
+		while (!found.load() && stop.load() == NOT_STOPPED) {
+			StopReason reason = budget.check(expanded.load(), history_bytes.load());
+			if (reason != NOT_STOPPED) {
+				int expected = NOT_STOPPED;
+				stop.compare_exchange_strong(expected, reason);
+				return;
+			}
+			bool has_task = queues[self].pop(task);
+			for (unsigned k = 1; k < threads && !has_task; k++)
+				has_task = queues[(self + k) % threads].steal(task);
+			if (!has_task) {
+				if (pending.load() == 0)
+					return; // Все состояния раскрыты
+				std::this_thread::yield();
+				continue;
+			}
+
+			VertexIDSeq to_modify = chooseVerticesToModify(g, task.state, influence);
+			for (VertexIDSeq::const_iterator vid = to_modify.begin(); vid != to_modify.end() && !found.load(); vid++) {
+				const ValueClasses &equiv_classes = g.vertex(*vid).equivalenceClasses();
+				for (ValueClasses::const_iterator ec = equiv_classes.begin(); ec != equiv_classes.end(); ec++) {
+					EquivalenceClass expected_outcome = merge(task.state.satisfied, ec->edges_bitset, ec->unsatisfied_edges);
+					influence.restrict(expected_outcome);
+					if (!classes_history.insert(expected_outcome)) {
+						counters.duplicateStates++;
+						continue;
+					}
+					expanded++;
+					counters.countBranch(g.vertex(*vid).index());
+					history_bytes += stateBytes(expected_outcome);
+					SearchTask child({ task.state, std::shared_ptr<const TraceNode>() });
+					ValueType old_value = g.setValue(child.state, *vid, ec->val);
+					child.trace = std::make_shared<const TraceNode>(TraceNode({ { *vid, old_value, ec->val }, task.trace }));
+					if (child.state.accessible.contains(target_index)) {
+						std::lock_guard<std::mutex> lock(witness_mutex);
+						if (!found.load()) {
+							witness = child.trace;
+							found.store(true);
+						}
+						break;
+					}
+					pending++;
+					queues[self].push(std::move(child));
+				}
+			}
+			pending--;
+		}
+	};
+
+	std::vector<std::thread> workers;
+	SolverStats worker_stats; // Счетчики остальных потоков; текущий собирает свои в stats_scope
+	std::mutex stats_mutex;
+	for (unsigned k = 1; k < threads; k++) {
+		workers.push_back(std::thread([&, k]() {
+			worker(k);
+			std::lock_guard<std::mutex> lock(stats_mutex);
+			worker_stats += threadStats();
+		}));
+	}
+	worker(0);
+	for (size_t k = 0; k < workers.size(); k++)
+		workers[k].join();
+	threadStats() += worker_stats;
+	statesExpanded = expanded.load();
+	historyBytes = history_bytes.load();
+	stopReason = static_cast<StopReason>(stop.load());
+
+	if (!found.load()) {
+		AV_TRACE_EVENT(*this, AV_TRACE_RESULT, TraceEvent::FAILURE, 0);
+		outcome = stopReason == NOT_STOPPED ? INACCESSIBLE : UNKNOWN;
+		return false;
+	}
+	stopReason = NOT_STOPPED; // Доступ получен раньше, чем ограничение остановило остальные потоки
+	std::vector<UpdateInfo> changes;
+	for (const TraceNode *node = witness.get(); node; node = node->parent.get())
+		changes.push_back(node->change);
+	for (std::vector<UpdateInfo>::reverse_iterator c = changes.rbegin(); c != changes.rend(); c++)
+		trace.push(*c);
+	AV_TRACE_EVENT(*this, AV_TRACE_RESULT, TraceEvent::SUCCESS, trace.size());
+	outcome = ACCESSIBLE;
+	return true;
+}
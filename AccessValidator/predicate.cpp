@@ -1,25 +1,182 @@
 ﻿#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include "predicate.h"
 
 Predicate::Predicate(const std::vector<Interval>& truth_intervals)
 	: truth_intervals_()
 {
-	for (int k = 0; k < truth_intervals.size(); k++)
-		addInterval(truth_intervals[k]);
+	truth_intervals_.reserve(truth_intervals.size());
+	for (int k = 0; k < truth_intervals.size(); k++) {
+		if (!truth_intervals[k].isEmpty())
+			truth_intervals_.push_back(truth_intervals[k]);
+	}
+	normalize();
+}
+
+// Левая граница a начинается раньше левой границы b
+static bool startsBefore(const Interval &a, const Interval &b) {
+	return a.left < b.left || (a.left == b.left && (a.border & Interval::LEFT_CLOSED) && !(b.border & Interval::LEFT_CLOSED));
+}
+
+// Правая граница a заканчивается позже правой границы b
+static bool endsAfter(const Interval &a, const Interval &b) {
+	return a.right > b.right || (a.right == b.right && (a.border & Interval::RIGHT_CLOSED) && !(b.border & Interval::RIGHT_CLOSED));
+}
+
+// Интервал a, начинающийся не позже b, пересекается с b или примыкает к нему без зазора
+static bool connected(const Interval &a, const Interval &b) {
+	return a.right > b.left || (a.right == b.left && ((a.border & Interval::RIGHT_CLOSED) || (b.border & Interval::LEFT_CLOSED)));
+}
+
+// Объединение связанных интервалов
+static Interval join(const Interval &a, const Interval &b) {
+	const Interval &l = startsBefore(b, a) ? b : a;
+	const Interval &r = endsAfter(b, a) ? b : a;
+	return { l.left, r.right, Interval::BorderType((l.border & Interval::LEFT_CLOSED) | (r.border & Interval::RIGHT_CLOSED)) };
+}
+
+bool Predicate::isNormalized(const std::vector<Interval>& truth_intervals)
+{
+	for (size_t k = 0; k < truth_intervals.size(); k++) {
+		const Interval &i = truth_intervals[k];
+		if (!(i.left <= i.right) || i.isEmpty()) // В том числе NaN
+			return false;
+		// Непустой интервал, не связанный с предыдущим, начинается правее его
+		if (k > 0 && connected(truth_intervals[k - 1], i))
+			return false;
+	}
+	return true;
+}
+
+Predicate Predicate::fromNormalized(const std::vector<Interval>& truth_intervals)
+{
+	Predicate p;
+	p.truth_intervals_ = truth_intervals;
+	return p;
+}
+
+void Predicate::normalize()
+{
+	if (truth_intervals_.size() < 2)
+		return;
+	std::sort(truth_intervals_.begin(), truth_intervals_.end(), startsBefore);
+	size_t last = 0;
+	for (size_t k = 1; k < truth_intervals_.size(); k++) {
+		if (connected(truth_intervals_[last], truth_intervals_[k]))
+			truth_intervals_[last] = join(truth_intervals_[last], truth_intervals_[k]);
+		else
+			truth_intervals_[++last] = truth_intervals_[k];
+	}
+	truth_intervals_.resize(last + 1);
 }
 
 bool Predicate::check(double x) const {
-	for (int k = 0; k < truth_intervals_.size(); k++)
-		if (truth_intervals_[k].contains(x))
-			return true;
+	// Левые границы интервалов различны, поэтому достаточно проверить последний интервал, начинающийся не правее x
+	std::vector<Interval>::const_iterator i = std::upper_bound(truth_intervals_.begin(), truth_intervals_.end(), x,
+		[](double value, const Interval &interval) { return value < interval.left; });
+	return i != truth_intervals_.begin() && (i - 1)->contains(x);
+}
+
+void Predicate::checkMany(const double *values, size_t n, uint8_t *result) const
+{
+	// Для небольшого числа интервалов проверяем все интервалы без ветвлений;
+	// внутренний цикл по значениям векторизуется компилятором.
+	const size_t linear_check_limit = 8;
+	if (truth_intervals_.size() > linear_check_limit) {
+		for (size_t j = 0; j < n; j++)
+			result[j] = check(values[j]);
+		return;
+	}
+	std::fill(result, result + n, 0);
+	for (size_t k = 0; k < truth_intervals_.size(); k++) {
+		const double left = truth_intervals_[k].left;
+		const double right = truth_intervals_[k].right;
+		const bool left_closed = (truth_intervals_[k].border & Interval::LEFT_CLOSED) != 0;
+		const bool right_closed = (truth_intervals_[k].border & Interval::RIGHT_CLOSED) != 0;
+		for (size_t j = 0; j < n; j++) {
+			const double x = values[j];
+			result[j] |= uint8_t(((left < x) | ((left <= x) & left_closed)) & ((x < right) | ((x <= right) & right_closed)));
+		}
+	}
+}
+
+// Принадлежность x интервалу с границами left, right типа B
+template<Interval::BorderType B> struct IntervalBorders;
+template<> struct IntervalBorders<Interval::OPEN> {
+	static bool contains(double left, double right, double x) { return (left < x) & (x < right); }
+};
+template<> struct IntervalBorders<Interval::RIGHT_CLOSED> {
+	static bool contains(double left, double right, double x) { return (left < x) & (x <= right); }
+};
+template<> struct IntervalBorders<Interval::LEFT_CLOSED> {
+	static bool contains(double left, double right, double x) { return (left <= x) & (x < right); }
+};
+template<> struct IntervalBorders<Interval::DOUBLE_CLOSED> {
+	static bool contains(double left, double right, double x) { return (left <= x) & (x <= right); }
+};
+
+template<Interval::BorderType B> bool PredicateKernel::checkInterval(const PredicateKernel &k, double x) {
+	return IntervalBorders<B>::contains(k.left_, k.right_, x);
+}
+
+// B - тип границ промежутка между интервалами дополнения; бесконечности в дополнение не входят
+template<Interval::BorderType B> bool PredicateKernel::checkComplement(const PredicateKernel &k, double x) {
+	const double inf = std::numeric_limits<double>::infinity();
+	return !IntervalBorders<B>::contains(k.left_, k.right_, x) & IntervalBorders<Interval::OPEN>::contains(-inf, inf, x);
+}
+
+bool PredicateKernel::checkEmpty(const PredicateKernel &, double) {
 	return false;
 }
 
+bool PredicateKernel::checkGeneral(const PredicateKernel &k, double x) {
+	return k.general_->check(x);
+}
+
+PredicateKernel::PredicateKernel(const Predicate &p)
+	: check_(&checkGeneral), left_(0), right_(0), general_(&p)
+{
+	// Номера в таблицах совпадают со значениями BorderType
+	static const CheckFunction intervals[] = { &checkInterval<Interval::OPEN>, &checkInterval<Interval::RIGHT_CLOSED>,
+		&checkInterval<Interval::LEFT_CLOSED>, &checkInterval<Interval::DOUBLE_CLOSED> };
+	static const CheckFunction complements[] = { &checkComplement<Interval::OPEN>, &checkComplement<Interval::RIGHT_CLOSED>,
+		&checkComplement<Interval::LEFT_CLOSED>, &checkComplement<Interval::DOUBLE_CLOSED> };
+	const std::vector<Interval> &i = p.intervals();
+	if (i.empty()) {
+		check_ = &checkEmpty;
+	}
+	else if (i.size() == 1) {
+		left_ = i[0].left;
+		right_ = i[0].right;
+		check_ = intervals[i[0].border];
+	}
+	else if (i.size() == 2 && std::isinf(i[0].left) && i[0].left < 0 && std::isinf(i[1].right) && i[1].right > 0
+			&& !(i[0].border & Interval::LEFT_CLOSED) && !(i[1].border & Interval::RIGHT_CLOSED)) {
+		// Граница промежутка замкнута там, где открыт примыкающий к ней интервал
+		left_ = i[0].right;
+		right_ = i[1].left;
+		check_ = complements[((i[0].border & Interval::RIGHT_CLOSED) ? 0 : Interval::LEFT_CLOSED) |
+			((i[1].border & Interval::LEFT_CLOSED) ? 0 : Interval::RIGHT_CLOSED)];
+	}
+}
+
 void Predicate::addInterval(const Interval & truth_interval)
 {
-	// FIXME: удалить возможные пересечения входных интервалов
-	truth_intervals_.push_back(truth_interval);
+	if (truth_interval.isEmpty())
+		return;
+	// Первый интервал, который может слиться с новым: предыдущий по левой границе либо следующий за ним
+	std::vector<Interval>::iterator first = std::upper_bound(truth_intervals_.begin(), truth_intervals_.end(), truth_interval, startsBefore);
+	if (first != truth_intervals_.begin() && connected(*(first - 1), truth_interval))
+		--first;
+	Interval merged = truth_interval;
+	std::vector<Interval>::iterator last = first;
+	while (last != truth_intervals_.end() && (startsBefore(*last, merged) ? connected(*last, merged) : connected(merged, *last))) {
+		merged = join(merged, *last);
+		++last;
+	}
+	first = truth_intervals_.erase(first, last);
+	truth_intervals_.insert(first, merged);
 }
 
 static Interval::BorderType borderType(int closeness_bitset) {
@@ -45,12 +202,12 @@ Predicate intersect(const Predicate & p1, const Predicate &p2)
 			double left = std::max(i->left, p2_i->left);
 			double right = std::min(i->right, p2_i->right);
 			Interval::BorderType bt = borderType(
-				((i->left < p2_i->left ? p2_i->border : i->border) & Interval::LEFT_CLOSED) |
-				((i->right > p2_i->right ? p2_i->border : i->border) & Interval::RIGHT_CLOSED));
-			if (left < right || bt != Interval::OPEN)
-				result.addInterval({ left, right, bt });
+				((startsBefore(*i, *p2_i) ? p2_i->border : i->border) & Interval::LEFT_CLOSED) |
+				((endsAfter(*i, *p2_i) ? p2_i->border : i->border) & Interval::RIGHT_CLOSED));
+			result.addInterval({ left, right, bt }); // пустые интервалы отбрасываются
 		}
-		if (i->right < p2_i->left)
+		// Интервалы обоих предикатов упорядочены и не пересекаются: сдвигаемся по тому, что заканчивается раньше
+		if (endsAfter(*p2_i, *i))
 			i++;
 		else
 			p2_i++;
@@ -2,7 +2,8 @@
 
 #include <limits>
 #include <vector>
-#include <bitset>
+#include <cstddef>
+#include <cstdint>
 #include <unordered_set>
 
 
@@ -15,23 +16,35 @@ struct Interval {
 		return ((left < x) || ((left <= x) && (border & LEFT_CLOSED))) &&
 			((x < right) || (x <= right && (border & RIGHT_CLOSED)));
 	}
+	bool isEmpty() const {
+		return right < left || (left == right && border != DOUBLE_CLOSED);
+	}
 };
 
 class Predicate {
 	std::vector<Interval> truth_intervals_; // Интервалы без пересечений, в порядке возрастания левой границы.
+
+	void normalize(); // Упорядочивает и объединяет пересекающиеся или примыкающие интервалы
 public:
 	// Создание по множеству интервалов, на которых предикат принимает истинное значени.
 	// Входные интервалы могут пересекаться и перечисляться в произвольном порядке.
 	Predicate(const std::vector<Interval>& truth_intervals);
+	// Интервалы уже в том виде, в каком их хранит предикат (intervals()): непустые, упорядоченные,
+	// без пересечений и примыканий. Проверка за один проход, без сортировки.
+	static bool isNormalized(const std::vector<Interval>& truth_intervals);
+	// Создание без нормализации; интервалы должны удовлетворять isNormalized()
+	static Predicate fromNormalized(const std::vector<Interval>& truth_intervals);
 	// По умолчанию создаем тождественно верный предикат
 	Predicate() {
 		addInterval({ -1 * std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), Interval::OPEN }); 
 	}
 
-	bool check(double x) const; // выполнимость в точке x
+	bool check(double x) const; // выполнимость в точке x; двоичный поиск по интервалам
+	// Выполнимость в точках values[0..n-1]; результат (0 или 1) записывается в result[0..n-1]
+	void checkMany(const double *values, size_t n, uint8_t *result) const;
 	const std::vector<Interval>& intervals() const { return truth_intervals_; }
 	void clear() { truth_intervals_.clear(); }
-	void addInterval(const Interval& truth_interval);
+	void addInterval(const Interval& truth_interval); // Сохраняет упорядоченность и отсутствие пересечений
 
 	// Тождественно ложен?
 	bool isEmpty() const { return truth_intervals_.empty(); }
@@ -40,3 +53,30 @@ public:
 	double sample() const; // Поиск значения при котором предикат выполняется
 	friend std::ostream& operator<< (std::ostream &os, const Predicate &p);	
 };
+
+// Компактная форма предиката для частой проверки (выполненность ребер в Graph::setValue).
+// Вид предиката определяется один раз при построении, и проверка вызывается через указатель на
+// соответствующую специализацию шаблона:
+// - один интервал (в том числе полупрямая или вся прямая) - пара сравнений без ветвлений, вид сравнений
+//   задается типом границ;
+// - дополнение интервала: (-inf, a) и (b, +inf) с любыми границами в a и b, открытые на бесконечностях, -
+//   отрицание проверки промежутка;
+// - тождественно ложный предикат;
+// - остальные - Predicate::check() по исходному предикату, который должен существовать, пока используется форма.
+class PredicateKernel {
+	typedef bool(*CheckFunction)(const PredicateKernel &k, double x);
+	CheckFunction check_;
+	double left_; // Границы интервала или промежутка дополнения
+	double right_;
+	const Predicate *general_; // Только для общего случая
+
+	template<Interval::BorderType B> static bool checkInterval(const PredicateKernel &k, double x);
+	template<Interval::BorderType B> static bool checkComplement(const PredicateKernel &k, double x);
+	static bool checkEmpty(const PredicateKernel &k, double x);
+	static bool checkGeneral(const PredicateKernel &k, double x);
+public:
+	explicit PredicateKernel(const Predicate &p);
+
+	bool check(double x) const { return check_(*this, x); }
+	bool isGeneral() const { return check_ == &checkGeneral; }
+};
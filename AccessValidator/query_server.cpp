@@ -0,0 +1,467 @@
+﻿#include <iostream>
+#include <sstream>
+#include <limits>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+#include <cmath>
+#include <cctype>
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "query_server.h"
+
+//
+// Разбор запроса
+//
+
+// Число по грамматике JSON: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+// (strtod принимает также nan, inf и шестнадцатеричную запись)
+static bool isJsonNumber(const char *s, size_t n) {
+	size_t k = 0;
+	if (k < n && s[k] == '-')
+		k++;
+	if (k < n && s[k] == '0')
+		k++;
+	else if (k < n && s[k] >= '1' && s[k] <= '9')
+		while (k < n && std::isdigit(static_cast<unsigned char>(s[k])))
+			k++;
+	else
+		return false;
+	if (k < n && s[k] == '.') {
+		if (++k >= n || !std::isdigit(static_cast<unsigned char>(s[k])))
+			return false;
+		while (k < n && std::isdigit(static_cast<unsigned char>(s[k])))
+			k++;
+	}
+	if (k < n && (s[k] == 'e' || s[k] == 'E')) {
+		if (++k < n && (s[k] == '+' || s[k] == '-'))
+			k++;
+		if (k >= n || !std::isdigit(static_cast<unsigned char>(s[k])))
+			return false;
+		while (k < n && std::isdigit(static_cast<unsigned char>(s[k])))
+			k++;
+	}
+	return k == n;
+}
+
+static std::string quoted(const std::string &s) {
+	std::string result = "\"";
+	for (size_t k = 0; k < s.size(); k++) {
+		if (s[k] == '"' || s[k] == '\\')
+			result += '\\';
+		if (static_cast<unsigned char>(s[k]) < 0x20)
+			result += ' ';
+		else
+			result += s[k];
+	}
+	return result + "\"";
+}
+
+// Чтение одной записи JSON. Разбирается только то, что нужно запросу; значения остальных полей пропускаются.
+class JsonReader {
+	const std::string &text_;
+	size_t pos_;
+public:
+	explicit JsonReader(const std::string &text) : text_(text), pos_(0) {}
+
+	void skipSpaces() {
+		while (pos_ < text_.size() && std::strchr(" \t\r\n", text_[pos_]))
+			pos_++;
+	}
+	bool atEnd() { skipSpaces(); return pos_ == text_.size(); }
+	char peek() { skipSpaces(); return pos_ < text_.size() ? text_[pos_] : '\0'; }
+	void expect(char c) {
+		if (peek() != c)
+			throw BadQuery(std::string("expected '") + c + "'");
+		pos_++;
+	}
+
+	std::string string() {
+		expect('"');
+		std::string result;
+		while (pos_ < text_.size() && text_[pos_] != '"') {
+			char c = text_[pos_++];
+			if (c == '\\') {
+				if (pos_ >= text_.size())
+					break;
+				c = text_[pos_++];
+				switch (c) {
+				case 'b': c = '\b'; break;
+				case 'f': c = '\f'; break;
+				case 'n': c = '\n'; break;
+				case 'r': c = '\r'; break;
+				case 't': c = '\t'; break;
+				case 'u': // Символы вне ASCII в именах полей и номерах вершин не встречаются
+					if (pos_ + 4 > text_.size())
+						throw BadQuery("bad escape in string");
+					c = static_cast<char>(std::strtoul(text_.substr(pos_, 4).c_str(), 0, 16) & 0x7F);
+					pos_ += 4;
+					break;
+				default: break; // \" \\ \/
+				}
+			}
+			result += c;
+		}
+		if (pos_ >= text_.size())
+			throw BadQuery("unterminated string");
+		pos_++;
+		return result;
+	}
+
+	double number() {
+		skipSpaces();
+		const char *begin = text_.c_str() + pos_;
+		char *end;
+		double value = std::strtod(begin, &end);
+		if (end == begin || !isJsonNumber(begin, end - begin))
+			throw BadQuery("expected number");
+		if (!std::isfinite(value))
+			throw BadQuery("number out of range");
+		pos_ += end - begin;
+		return value;
+	}
+
+	// Пропускает значение любого вида и возвращает его исходный текст
+	std::string raw() {
+		skipSpaces();
+		const size_t begin = pos_;
+		if (peek() == '"')
+			string();
+		else if (peek() == '{' || peek() == '[') {
+			for (int depth = 0; ; ) {
+				if (pos_ >= text_.size())
+					throw BadQuery("unexpected end of query");
+				const char c = text_[pos_];
+				if (c == '"') {
+					string();
+					continue;
+				}
+				pos_++;
+				if (c == '{' || c == '[')
+					depth++;
+				else if ((c == '}' || c == ']') && --depth == 0)
+					break;
+			}
+		}
+		else {
+			while (pos_ < text_.size() && !std::strchr(",}] \t\r\n", text_[pos_]))
+				pos_++;
+			if (pos_ == begin)
+				throw BadQuery("expected value");
+		}
+		return text_.substr(begin, pos_ - begin);
+	}
+
+	// Обходит поля объекта; field вызывается для каждого имени и должен прочитать значение
+	void object(const std::function<void(const std::string&)> &field) {
+		expect('{');
+		if (peek() == '}') {
+			pos_++;
+			return;
+		}
+		for (;;) {
+			const std::string name = string();
+			expect(':');
+			field(name);
+			if (peek() == ',') {
+				pos_++;
+				continue;
+			}
+			expect('}');
+			return;
+		}
+	}
+};
+
+static VertexID vertexNumber(double value) {
+	if (!(value >= 0 && value <= std::numeric_limits<VertexID>::max()) || value != static_cast<VertexID>(value))
+		throw BadQuery("vertex must be a non-negative integer");
+	return static_cast<VertexID>(value);
+}
+
+void parseQuery(const std::string &line, Query &q) {
+	q = Query();
+	bool has_target = false;
+	JsonReader reader(line);
+	reader.object([&](const std::string &name) {
+		if (name == "id") {
+			// Строка выводится заново с экранированием, число - как есть после проверки записи
+			if (reader.peek() == '"')
+				q.id = quoted(reader.string());
+			else {
+				const std::string id = reader.raw();
+				if (!isJsonNumber(id.c_str(), id.size()))
+					throw BadQuery("id must be a string or a number");
+				q.id = id;
+			}
+		}
+		else if (name == "target") {
+			q.target = vertexNumber(reader.number());
+			has_target = true;
+		}
+		else if (name == "values") {
+			reader.object([&](const std::string &vertex) {
+				char *end;
+				const double vid = std::strtod(vertex.c_str(), &end);
+				if (vertex.empty() || *end)
+					throw BadQuery("bad vertex in values: " + vertex);
+				q.values.push_back(std::make_pair(vertexNumber(vid), reader.number()));
+			});
+		}
+		else
+			reader.raw();
+	});
+	if (!reader.atEnd())
+		throw BadQuery("extra characters after query");
+	if (!has_target)
+		throw BadQuery("missing target");
+}
+
+//
+// Ответы
+//
+
+// Значения выводятся с точностью, достаточной для их точного восстановления
+static std::ostream& value(std::ostream &os, ValueType v) {
+	if (!std::isfinite(v))
+		return os << "null"; // В JSON нет бесконечностей
+	const std::streamsize precision = os.precision(std::numeric_limits<ValueType>::max_digits10);
+	os << v;
+	os.precision(precision);
+	return os;
+}
+
+QueryServer::QueryServer(const Graph &g, const ServerOptions &options) : g_(g), options_(options) {
+	if (options_.threads == 0)
+		options_.threads = std::max(1u, std::thread::hardware_concurrency());
+	if (options_.mode == "components")
+		condensation_ = computeCondensation(g_);
+}
+
+std::string QueryServer::answer(const std::string &line, GraphState &state, Solver &solver) const {
+	std::ostringstream os;
+	Query q;
+	bool marked = false; // Значения запроса заданы и должны быть откачены
+	Graph::Checkpoint mark = 0;
+	std::string error;
+	try {
+		parseQuery(line, q);
+		if (!g_.hasVertex(q.target))
+			throw BadQuery("no such vertex: " + std::to_string(q.target));
+		for (size_t k = 0; k < q.values.size(); k++)
+			if (!g_.hasVertex(q.values[k].first))
+				throw BadQuery("no such vertex: " + std::to_string(q.values[k].first));
+
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		mark = g_.checkpoint(state);
+		marked = true;
+		for (size_t k = 0; k < q.values.size(); k++)
+			g_.overrideValue(state, q.values[k].first, q.values[k].second);
+		solver.options.maxStates = options_.maxStates;
+		solver.options.deadline = options_.deadlineMs > 0
+			? start + std::chrono::microseconds(static_cast<long long>(options_.deadlineMs * 1000))
+			: std::chrono::steady_clock::time_point();
+		if (options_.mode == "components")
+			solver.componentSolver(g_, state, q.target, condensation_);
+		else if (options_.mode == "best" || options_.mode == "astar")
+			solver.bestFirstSolver(g_, state, q.target, options_.mode == "astar");
+		else
+			solver.shortestSolver(g_, state, q.target);
+		g_.rollback(state, mark);
+		marked = false;
+		const double ms = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e3;
+
+		static const char *outcomes[] = { "accessible", "inaccessible", "unknown" };
+		os << "{";
+		if (!q.id.empty())
+			os << "\"id\": " << q.id << ", ";
+		os << "\"target\": " << q.target << ", \"outcome\": \"" << outcomes[solver.outcome] << "\", \"witness\": [";
+		std::vector<Solver::UpdateInfo> witness;
+		for (std::stack<Solver::UpdateInfo> t = solver.trace; !t.empty(); t.pop())
+			witness.push_back(t.top());
+		for (size_t k = witness.size(); k-- > 0; ) {
+			os << (k + 1 < witness.size() ? ", " : "") << "{\"vertex\": " << witness[k].vid << ", \"old\": ";
+			value(os, witness[k].old) << ", \"new\": ";
+			value(os, witness[k].newValue) << "}";
+		}
+		os << "], \"states_expanded\": " << solver.statesExpanded << ", \"ms\": " << ms << "}";
+	}
+	// Ошибка при решении (нехватка памяти и т.п.) завершает только этот запрос
+	catch (const BadQuery &e) {
+		error = e.reason;
+	}
+	catch (const std::exception &e) {
+		error = std::string("internal error: ") + e.what();
+	}
+	catch (const Error &) {
+		error = "internal error";
+	}
+	if (error.empty())
+		return os.str();
+	if (marked)
+		g_.rollback(state, mark); // Состояние потока остается пригодным для следующих запросов
+	os.str("");
+	os << "{";
+	if (!q.id.empty())
+		os << "\"id\": " << q.id << ", ";
+	os << "\"error\": " << quoted(error) << "}";
+	return os.str();
+}
+
+size_t QueryServer::serve(const std::function<bool(std::string&)> &read_line,
+		const std::function<void(const std::string&)> &write) {
+	// Очередь строк между читающим потоком и обработчиками; ограничена, чтобы чтение не опережало обработку
+	std::deque<std::string> queue;
+	const size_t queue_limit = 4 * options_.threads;
+	bool finished = false;
+	std::mutex queue_mutex, write_mutex;
+	std::condition_variable not_empty, not_full;
+
+	auto worker = [&]() {
+		GraphState state = g_.state(); // Своя копия состояния на все время работы
+		Solver solver;
+		std::string line;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				not_empty.wait(lock, [&]() { return finished || !queue.empty(); });
+				if (queue.empty())
+					return;
+				line.swap(queue.front());
+				queue.pop_front();
+			}
+			not_full.notify_one();
+			const std::string reply = answer(line, state, solver);
+			std::lock_guard<std::mutex> lock(write_mutex);
+			write(reply);
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned k = 0; k < options_.threads; k++)
+		workers.push_back(std::thread(worker));
+	size_t count = 0;
+	std::string line;
+	while (read_line(line)) {
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue; // Пустые строки пропускаются
+		std::unique_lock<std::mutex> lock(queue_mutex);
+		not_full.wait(lock, [&]() { return queue.size() < queue_limit; });
+		queue.push_back(line);
+		count++;
+		lock.unlock();
+		not_empty.notify_one();
+	}
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		finished = true;
+	}
+	not_empty.notify_all();
+	for (size_t k = 0; k < workers.size(); k++)
+		workers[k].join();
+	return count;
+}
+
+size_t QueryServer::serve(std::istream &in, std::ostream &out) {
+	return serve([&in](std::string &line) { return static_cast<bool>(std::getline(in, line)); },
+		[&out](const std::string &reply) { out << reply << std::endl; });
+}
+
+#ifdef _WIN32
+
+bool QueryServer::serveSocket(const std::string &) {
+	return false;
+}
+
+#else
+
+// Чтение строк из сокета с буферизацией
+class SocketLines {
+	int fd_;
+	std::string buffer_;
+	size_t pos_;
+	bool eof_;
+public:
+	explicit SocketLines(int fd) : fd_(fd), pos_(0), eof_(false) {}
+	bool operator()(std::string &line) {
+		for (;;) {
+			const size_t newline = buffer_.find('\n', pos_);
+			if (newline != std::string::npos) {
+				line.assign(buffer_, pos_, newline - pos_);
+				pos_ = newline + 1;
+				return true;
+			}
+			if (eof_) {
+				if (pos_ == buffer_.size())
+					return false;
+				line.assign(buffer_, pos_, std::string::npos); // Последняя строка без перевода строки
+				pos_ = buffer_.size();
+				return true;
+			}
+			buffer_.erase(0, pos_);
+			pos_ = 0;
+			char chunk[4096];
+			const ssize_t n = read(fd_, chunk, sizeof(chunk));
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				eof_ = true;
+			else
+				buffer_.append(chunk, n);
+		}
+	}
+};
+
+bool QueryServer::serveSocket(const std::string &path) {
+	sockaddr_un address;
+	if (path.size() >= sizeof(address.sun_path))
+		return false;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	std::strcpy(address.sun_path, path.c_str());
+
+	const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0)
+		return false;
+	unlink(path.c_str()); // Сокет, оставшийся от прежнего запуска
+	if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 || listen(listener, 16) < 0) {
+		close(listener);
+		return false;
+	}
+	for (;;) {
+		const int connection = accept(listener, 0, 0);
+		if (connection < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		bool connected = true; // После ошибки записи ответы отбрасываются, а запросы дочитываются
+		serve(SocketLines(connection), [&](const std::string &reply) {
+			const std::string data = reply + "\n";
+			for (size_t sent = 0; connected && sent < data.size(); ) {
+				const ssize_t n = send(connection, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n <= 0)
+					connected = false;
+				else
+					sent += n;
+			}
+		});
+		close(connection);
+	}
+	close(listener);
+	unlink(path.c_str());
+	return true;
+}
+
+#endif
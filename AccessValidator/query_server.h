@@ -0,0 +1,74 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+#include "AccessValidator.h"
+#include "search.h"
+
+// Сервер запросов доступа: граф загружается один раз, запросы читаются по одному в строке (NDJSON)
+// и решаются на нескольких потоках. У каждого потока своя копия состояния графа (GraphState); значения
+// вершин из запроса задаются в ней через журнал отмены и после ответа откатываются, поэтому запрос
+// не копирует состояние и не изменяет граф. Последовательность изменений для ответа повторяется на том же
+// состоянии и тоже откатывается. Разбиение на компоненты для режима components вычисляется один раз.
+// Остальная подготовка запроса (влияющая на цель часть графа, таблицы компонент) занимает O(V + E/64),
+// так что время ответа все же растет с размером графа, хотя и без копирования состояния.
+//
+// Запрос:  {"id": 7, "target": 12, "values": {"3": 0.5, "8": -2}}
+//   id - необязательно, строка или число JSON, возвращается в ответе в том же виде;
+//   values - необязательно, значения вершин на время запроса (конечные числа).
+// Ответ:   {"id": 7, "target": 12, "outcome": "accessible", "witness": [{"vertex": 3, "old": 0.5, "new": 2}],
+//           "states_expanded": 40, "ms": 0.8}
+//   outcome - accessible, inaccessible или unknown (перебор прерван ограничением);
+//   witness - изменения значений в порядке выполнения, открывающие доступ.
+// Ошибка в запросе или при его решении: {"id": 7, "error": "..."}; сервер продолжает работу.
+// Ответы выводятся по мере готовности и могут идти не в порядке запросов.
+
+// Ошибка в строке запроса
+class BadQuery : public Error {
+public:
+	std::string reason;
+	explicit BadQuery(const std::string &r) : reason(r) {}
+};
+
+struct Query {
+	std::string id; // Значение "id" в виде JSON: строка в кавычках или число; пустое, если поля нет
+	VertexID target;
+	std::vector<std::pair<VertexID, ValueType> > values;
+
+	Query() : target(0) {}
+};
+
+// Бросает BadQuery; поля, прочитанные до ошибки (например, id), остаются заполненными для ответа
+void parseQuery(const std::string &line, Query &q);
+
+struct ServerOptions {
+	unsigned threads; // 0 - по числу ядер
+	std::string mode; // bfs (shortestSolver), best, astar (bestFirstSolver) или components (componentSolver)
+	size_t maxStates; // Ограничение перебора одного запроса числом состояний (0 - без ограничения)
+	double deadlineMs; // То же по времени, отсчитывается от начала перебора (0 - без ограничения)
+
+	ServerOptions() : threads(0), mode("bfs"), maxStates(0), deadlineMs(0) {}
+};
+
+class QueryServer {
+	const Graph &g_;
+	ServerOptions options_;
+	Condensation condensation_; // Для режима components
+
+	// Ответ на запрос line; state - состояние графа потока с включенным журналом отмены
+	std::string answer(const std::string &line, GraphState &state, Solver &solver) const;
+public:
+	QueryServer(const Graph &g, const ServerOptions &options);
+
+	// Читает запросы, пока read_line возвращает true, и передает ответы в write (по одной строке без перевода строки).
+	// Возвращает число обработанных запросов.
+	size_t serve(const std::function<bool(std::string&)> &read_line, const std::function<void(const std::string&)> &write);
+	size_t serve(std::istream &in, std::ostream &out);
+	// Принимает соединения на сокете Unix с путем path и обслуживает их по очереди: следующее соединение
+	// принимается после закрытия текущего, и для каждого запускаются свои потоки serve(). Медленный клиент
+	// задерживает остальных. Возвращает false, если сокет не удалось создать (или платформа их не поддерживает);
+	// иначе работает, пока процесс не остановят.
+	bool serveSocket(const std::string &path);
+};
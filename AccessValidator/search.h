@@ -0,0 +1,130 @@
+﻿#pragma once
+
+#include <deque>
+#include <vector>
+#include <stack>
+#include "AccessValidator.h"
+
+// Общие части разных вариантов перебора
+
+typedef typename std::deque<VertexID> VertexIDSeq;
+
+// Часть графа, от которой зависит доступность целевой вершины.
+// Доступность вершины определяется ее исходящими ребрами, а выполненность ребра - значением его конца,
+// поэтому на цель влияют только вершины, достижимые из нее по исходящим ребрам, и исходящие ребра
+// цели и этих вершин. Изменения остальных вершин и ребер можно не рассматривать.
+struct TargetInfluence {
+	std::vector<bool> vertices; // По порядковым номерам вершин (Vertex::index())
+	EdgesBitset edges;
+
+	bool relevant(const Vertex &v) const { return vertices[v.index()]; }
+	// Ограничение класса эквивалентности на влияющие ребра
+	void restrict(EquivalenceClass &c) const { c &= edges; }
+};
+
+TargetInfluence computeInfluence(const Graph &g, VertexID target);
+// Объединение влияющих частей для нескольких целей; отсутствующие в графе цели пропускаются
+TargetInfluence computeInfluence(const Graph &g, const std::vector<VertexID> &targets);
+
+// Разбиение графа на компоненты сильной связности по исходящим ребрам (Vertex::successors()).
+// Компоненты пронумерованы в обратном топологическом порядке: ребро между компонентами всегда ведет
+// в компоненту с меньшим номером, то есть от зависимой вершины к той, от которой зависит ее доступность.
+struct Condensation {
+	std::vector<size_t> component; // Номер компоненты по порядковому номеру вершины
+	std::vector<std::vector<VertexIndex> > members; // Вершины каждой компоненты
+};
+
+Condensation computeCondensation(const Graph &g);
+
+// Возвращает последовательность вершин для изменения (в порядке); рассматриваются только влияющие на цель вершины
+VertexIDSeq chooseVerticesToModify(const Graph &g, const GraphState &state, const TargetInfluence &influence);
+// То же с записью в result; память result переиспользуется
+void chooseVerticesToModify(const Graph &g, const GraphState &state, const TargetInfluence &influence, VertexIDSeq &result);
+
+// merge вычисляет (c1+c2) - removed.
+// c2 объединенное с removed дает битовое множество ребер, входящих в вершину.
+// Изменение значения в вершине приведет к тому, что ребра из c2 станут выполнены, а из removed - нет.
+// Вычисление идет пословно.
+inline EquivalenceClass merge(const EquivalenceClass &c1, const EquivalenceClass &c2, const EdgesBitset &removed) {
+	EquivalenceClass res(c1);
+	res |= c2;
+	res.andNot(removed);
+	return res;
+}
+
+// То же с записью в res; если размер res достаточен, память не выделяется
+inline void merge(EquivalenceClass &res, const EquivalenceClass &c1, const EquivalenceClass &c2, const EdgesBitset &removed) {
+	res = c1;
+	res |= c2;
+	res.andNot(removed);
+}
+
+// Вершина дерева поиска по состояниям (в ширину или по приоритету): откуда пришли и какое изменение сделали.
+// Сами состояния хранятся отдельно как упакованные множества выполненных ребер.
+struct ParentLink {
+	size_t parent; // Номер предыдущего состояния
+	VertexID vid; // Измененная вершина
+	size_t value_class; // Номер класса значений вершины vid
+};
+
+static const size_t no_parent = static_cast<size_t>(-1);
+
+// Записывает в trace изменения, ведущие от исходного состояния start к состоянию found.
+// Изменения выполняются на start для получения прежних значений и затем откатываются.
+void replayWitness(const Solver &solver, const Graph &g, GraphState &start, const std::vector<ParentLink> &parents,
+	size_t found, std::stack<Solver::UpdateInfo> &trace);
+
+// Приблизительный объем памяти, занимаемой состоянием в множестве просмотренных: сам объект,
+// его слова и узел хэш-таблицы
+inline size_t stateBytes(const EquivalenceClass &c) {
+	return sizeof(EquivalenceClass) + c.words().size() * sizeof(EdgeSet::Word) + 2 * sizeof(void*);
+}
+
+// Проверка ограничений SolverOptions в цикле перебора. Часы опрашиваются не на каждом шаге.
+class SearchBudget {
+	const SolverOptions &options_;
+public:
+	explicit SearchBudget(const SolverOptions &options) : options_(options) {}
+
+	// Причина остановки или NOT_STOPPED, если перебор можно продолжать
+	Solver::StopReason check(size_t states, size_t history_bytes) {
+		if (options_.cancel && options_.cancel->load(std::memory_order_relaxed))
+			return Solver::CANCELLED;
+		if (options_.maxStates && states >= options_.maxStates)
+			return Solver::STATE_LIMIT;
+		if (options_.maxHistoryBytes && history_bytes > options_.maxHistoryBytes)
+			return Solver::MEMORY_LIMIT;
+		// Часы опрашиваются при каждой проверке: раскрытие состояния дороже чтения steady_clock
+		if (options_.deadline != std::chrono::steady_clock::time_point()
+			&& std::chrono::steady_clock::now() >= options_.deadline)
+			return Solver::DEADLINE;
+		return Solver::NOT_STOPPED;
+	}
+};
+
+// Сбор статистики одного перебора на графе g. Пока объект существует, счетчики потока (threadStats()) пусты;
+// при уничтожении собранное вместе с итогами перебора (statesExpanded, historyBytes, длина trace) добавляется
+// к прежним счетчикам потока и вместе со временем построения g записывается в solver.stats.
+// Вложенный перебор (например, shortestSolver() из componentSolver()) учитывается во внешнем.
+class StatsScope {
+	Solver &solver_;
+	const Graph &g_;
+	SolverStats saved_;
+	std::chrono::steady_clock::time_point start_;
+public:
+	StatsScope(Solver &solver, const Graph &g) : solver_(solver), g_(g), start_(std::chrono::steady_clock::now()) {
+		std::swap(saved_, threadStats());
+	}
+	~StatsScope() {
+		SolverStats &current = threadStats();
+		current.statesExpanded = std::max(current.statesExpanded, solver_.statesExpanded);
+		current.historyPeakBytes = std::max(current.historyPeakBytes, solver_.historyBytes);
+		current.maxDepth = std::max(current.maxDepth, solver_.trace.size());
+		current.searchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+		saved_ += current;
+		std::swap(saved_, current);
+		solver_.stats = saved_;
+		solver_.stats.buildSeconds = g_.buildSeconds();
+		solver_.stats.classesSeconds = g_.classesSeconds();
+	}
+};
@@ -0,0 +1,266 @@
+﻿#include <vector>
+#include <unordered_set>
+#include <functional>
+#include <algorithm>
+#include "AccessValidator.h"
+#include "search.h"
+#include "trace.h"
+#include "solver_cache.h"
+
+// Восстанавливает путь до состояния found и повторяет изменения на start под контрольной точкой,
+// чтобы узнать прежние значения вершин; затем изменения откатываются
+void replayWitness(const Solver &solver, const Graph &g, GraphState &start, const std::vector<ParentLink> &parents,
+		size_t found, std::stack<Solver::UpdateInfo> &trace) {
+	std::vector<size_t> path;
+	for (size_t k = found; parents[k].parent != no_parent; k = parents[k].parent)
+		path.push_back(k);
+	const Graph::Checkpoint mark = g.checkpoint(start);
+	for (std::vector<size_t>::reverse_iterator k = path.rbegin(); k != path.rend(); k++) {
+		const ParentLink &link = parents[*k];
+		ValueType new_value = g.vertex(link.vid).equivalenceClasses()[link.value_class].val;
+		ValueType old_value = g.setValue(start, link.vid, new_value);
+		trace.push({ link.vid, old_value, new_value });
+		AV_TRACE_EVENT(solver, AV_TRACE_STEPS, TraceEvent::CHANGE, trace.size(), link.vid, old_value, new_value);
+	}
+	g.rollback(start, mark);
+}
+
+bool Solver::shortestSolver(const Graph &g, VertexID target) {
+	GraphState start = g.state();
+	return shortestSolver(g, start, target);
+}
+
+bool Solver::shortestSolver(const Graph &g, GraphState &start, VertexID target) {
+	this->trace = std::stack<UpdateInfo>();
+	this->statesExpanded = 0;
+	this->historyBytes = 0;
+	this->stopReason = NOT_STOPPED;
+	this->outcome = INACCESSIBLE;
+	StatsScope stats_scope(*this, g);
+	SolverStats &counters = threadStats();
+	g.update(start); // Состояние могло быть скопировано до изменений структуры графа
+	if (!g.hasVertex(target))
+		return false;
+	const Vertex &target_vertex = g.vertex(target);
+	if (target_vertex.checkAccessibility(start.satisfied)) {
+		outcome = ACCESSIBLE;
+		return true;
+	}
+
+	// Состояния хранятся ограниченными на ребра, влияющие на цель; остальные вершины не изменяются.
+	const TargetInfluence influence = computeInfluence(g, target);
+
+	// Состояния записываются в порядке обхода, поэтому массив states одновременно служит очередью.
+	// Множество просмотренных состояний хранит только их номера.
+	std::vector<EquivalenceClass> states;
+	std::vector<ParentLink> parents;
+	std::function<size_t(size_t)> state_hash = [&states](size_t k) { return states[k].hash(); };
+	std::function<bool(size_t, size_t)> state_equal = [&states](size_t a, size_t b) { return states[a] == states[b]; };
+	std::unordered_set<size_t, std::function<size_t(size_t)>, std::function<bool(size_t, size_t)> >
+		classes_history(16, state_hash, state_equal);
+
+	states.push_back(start.satisfied);
+	influence.restrict(states.back());
+	parents.push_back({ no_parent, 0, 0 });
+	classes_history.insert(0);
+	historyBytes = stateBytes(states[0]) + sizeof(ParentLink);
+	SearchBudget budget(options);
+
+	size_t found = no_parent;
+	size_t level = 0, level_end = 1; // Глубина состояния head; конец ее уровня в states
+	for (size_t head = 0; head < states.size() && found == no_parent; head++) {
+		if (head == level_end) {
+			level++;
+			level_end = states.size();
+		}
+		stopReason = budget.check(states.size() - 1, historyBytes);
+		if (stopReason != NOT_STOPPED)
+			break;
+		for (std::vector<Vertex>::const_iterator v = g.vertices().begin(); v != g.vertices().end() && found == no_parent; v++) {
+			const Vertex &vertex = *v;
+			if (!influence.relevant(vertex) || !vertex.checkAccessibility(states[head]))
+				continue;
+			const ValueClasses &equiv_classes = vertex.equivalenceClasses();
+			for (size_t c = 0; c < equiv_classes.size(); c++) {
+				states.push_back(merge(states[head], equiv_classes[c].edges_bitset, equiv_classes[c].unsatisfied_edges));
+				influence.restrict(states.back());
+				if (!classes_history.insert(states.size() - 1).second) {
+					states.pop_back();
+					counters.duplicateStates++;
+					continue;
+				}
+				parents.push_back({ head, vertex.id, c });
+				historyBytes += stateBytes(states.back()) + sizeof(ParentLink);
+				counters.countBranch(vertex.index());
+				counters.maxDepth = std::max(counters.maxDepth, level + 1);
+				if (target_vertex.checkAccessibility(states.back())) {
+					found = states.size() - 1;
+					break;
+				}
+			}
+		}
+	}
+	statesExpanded = states.size() - 1;
+	if (found == no_parent) {
+		AV_TRACE_EVENT(*this, AV_TRACE_RESULT, TraceEvent::FAILURE, 0);
+		outcome = stopReason == NOT_STOPPED ? INACCESSIBLE : UNKNOWN;
+		return false;
+	}
+
+	replayWitness(*this, g, start, parents, found, trace);
+	AV_TRACE_EVENT(*this, AV_TRACE_RESULT, TraceEvent::SUCCESS, trace.size());
+	outcome = ACCESSIBLE;
+	return true;
+}
+
+size_t Solver::batchSolver(const Graph &g, const std::vector<VertexID> &targets, std::vector<TargetResult> &results) {
+	this->trace = std::stack<UpdateInfo>();
+	this->statesExpanded = 0;
+	this->historyBytes = 0;
+	this->stopReason = NOT_STOPPED;
+	StatsScope stats_scope(*this, g);
+	SolverStats &counters = threadStats();
+	results.assign(targets.size(), TargetResult());
+
+	// Цели, доступ к которым еще не получен (номера в targets)
+	std::vector<size_t> unresolved;
+	std::vector<const Vertex*> target_vertices(targets.size(), 0);
+	size_t accessible_count = 0;
+	GraphState replay; // Копия состояния графа для повторения последовательностей; создается при первой необходимости
+	bool has_replay = false;
+	for (size_t k = 0; k < targets.size(); k++) {
+		results[k].target = targets[k];
+		results[k].accessible = false;
+		results[k].unknown = false;
+		if (!g.hasVertex(targets[k]))
+			continue;
+		target_vertices[k] = &g.vertex(targets[k]);
+		SolverCache::Result cached;
+		if (g.isAccessible(targets[k])) {
+			results[k].accessible = true;
+			accessible_count++;
+		}
+		else if (cache && cache->find(g, targets[k], cached)) {
+			// Кэш различает исходные состояния только по классу эквивалентности, поэтому прежние значения
+			// в сохраненной последовательности могут относиться к другим значениям вершин: повторим ее на копии
+			// текущего состояния, как solver()
+			results[k].accessible = cached.accessible;
+			accessible_count += cached.accessible ? 1 : 0;
+			if (!has_replay) {
+				replay = g.state();
+				has_replay = true;
+			}
+			const Graph::Checkpoint mark = g.checkpoint(replay);
+			for (std::vector<UpdateInfo>::const_iterator w = cached.witness.begin(); w != cached.witness.end(); w++) {
+				ValueType old_value = g.setValue(replay, w->vid, w->newValue);
+				results[k].trace.push({ w->vid, old_value, w->newValue });
+			}
+			g.rollback(replay, mark);
+		}
+		else
+			unresolved.push_back(k);
+	}
+	outcome = accessible_count == targets.size() ? ACCESSIBLE : INACCESSIBLE;
+	if (unresolved.empty())
+		return accessible_count;
+	const std::vector<size_t> searched(unresolved);
+
+	// Состояния ограничиваются на объединение ребер, влияющих хотя бы на одну из оставшихся целей
+	std::vector<VertexID> unresolved_ids;
+	for (size_t k = 0; k < unresolved.size(); k++)
+		unresolved_ids.push_back(targets[unresolved[k]]);
+	const TargetInfluence influence = computeInfluence(g, unresolved_ids);
+
+	std::vector<EquivalenceClass> states;
+	std::vector<ParentLink> parents;
+	std::function<size_t(size_t)> state_hash = [&states](size_t k) { return states[k].hash(); };
+	std::function<bool(size_t, size_t)> state_equal = [&states](size_t a, size_t b) { return states[a] == states[b]; };
+	std::unordered_set<size_t, std::function<size_t(size_t)>, std::function<bool(size_t, size_t)> >
+		classes_history(16, state_hash, state_equal);
+
+	states.push_back(g.equivalenceClass());
+	influence.restrict(states.back());
+	parents.push_back({ no_parent, 0, 0 });
+	classes_history.insert(0);
+	historyBytes = stateBytes(states[0]) + sizeof(ParentLink);
+	SearchBudget budget(options);
+
+	// Для каждой цели запоминается первое (при обходе в ширину - ближайшее) состояние, в котором она доступна
+	std::vector<size_t> found(targets.size(), no_parent);
+	size_t level = 0, level_end = 1; // Глубина состояния head; конец ее уровня в states
+	for (size_t head = 0; head < states.size() && !unresolved.empty(); head++) {
+		if (head == level_end) {
+			level++;
+			level_end = states.size();
+		}
+		stopReason = budget.check(states.size() - 1, historyBytes);
+		if (stopReason != NOT_STOPPED)
+			break;
+		for (std::vector<Vertex>::const_iterator v = g.vertices().begin(); v != g.vertices().end() && !unresolved.empty(); v++) {
+			const Vertex &vertex = *v;
+			if (!influence.relevant(vertex) || !vertex.checkAccessibility(states[head]))
+				continue;
+			const ValueClasses &equiv_classes = vertex.equivalenceClasses();
+			for (size_t c = 0; c < equiv_classes.size() && !unresolved.empty(); c++) {
+				states.push_back(merge(states[head], equiv_classes[c].edges_bitset, equiv_classes[c].unsatisfied_edges));
+				influence.restrict(states.back());
+				if (!classes_history.insert(states.size() - 1).second) {
+					states.pop_back();
+					counters.duplicateStates++;
+					continue;
+				}
+				parents.push_back({ head, vertex.id, c });
+				historyBytes += stateBytes(states.back()) + sizeof(ParentLink);
+				counters.countBranch(vertex.index());
+				counters.maxDepth = std::max(counters.maxDepth, level + 1);
+				for (size_t u = 0; u < unresolved.size(); /* empty */) {
+					if (target_vertices[unresolved[u]]->checkAccessibility(states.back())) {
+						found[unresolved[u]] = states.size() - 1;
+						unresolved[u] = unresolved.back();
+						unresolved.pop_back();
+					}
+					else
+						u++;
+				}
+			}
+		}
+	}
+	statesExpanded = states.size() - 1;
+
+	for (size_t k = 0; k < targets.size(); k++) {
+		if (found[k] == no_parent)
+			continue;
+		results[k].accessible = true;
+		accessible_count++;
+		if (!has_replay) {
+			replay = g.state();
+			has_replay = true;
+		}
+		replayWitness(*this, g, replay, parents, found[k], results[k].trace);
+		AV_TRACE_EVENT(*this, AV_TRACE_RESULT, TraceEvent::SUCCESS, results[k].trace.size(), targets[k]);
+	}
+
+	// Если обход прерван ограничением, то для оставшихся целей ответа нет
+	for (size_t u = 0; u < unresolved.size() && stopReason != NOT_STOPPED; u++)
+		results[unresolved[u]].unknown = true;
+	outcome = stopReason != NOT_STOPPED && !unresolved.empty() ? UNKNOWN
+		: accessible_count == targets.size() ? ACCESSIBLE : INACCESSIBLE;
+
+	// Кроме прерывания ограничением, обход завершается досрочно, только когда доступ получен ко всем целям,
+	// поэтому результат каждой рассмотренной цели, кроме неизвестных, окончателен
+	if (cache) {
+		for (size_t j = 0; j < searched.size(); j++) {
+			const TargetResult &r = results[searched[j]];
+			if (r.unknown)
+				continue;
+			SolverCache::Result cached = { r.accessible, std::vector<UpdateInfo>() };
+			for (std::stack<UpdateInfo> w = r.trace; !w.empty(); w.pop())
+				cached.witness.push_back(w.top());
+			std::reverse(cached.witness.begin(), cached.witness.end());
+			cache->storeResult(g, g.equivalenceClass(), r.target, cached);
+		}
+		if (!unresolved.empty() && stopReason == NOT_STOPPED)
+			cache->storeExplored(g, g.equivalenceClass(), influence.edges, states);
+	}
+	return accessible_count;
+}
@@ -1,35 +1,83 @@
 ﻿#include <stack>
-#include <unordered_set>
 #include <deque>
 #include <algorithm>
 #include <iterator>
 #include "AccessValidator.h"
-#include "utils.h"
 
-typedef std::unordered_set<EquivalenceClass> History;
+#include "search.h"
+#include "trace.h"
+#include "solver_cache.h"
+#include "state_store.h"
 
-typedef typename std::deque<VertexID> VertexIDSeq;
+// Изменение значения вершины с порядковым номером index на значение класса valueClass
+struct Move {
+	VertexIndex index;
+	const ValueClass *valueClass;
+	bool operator==(const Move &other) const { return index == other.index && valueClass == other.valueClass; }
+	bool operator<(const Move &other) const {
+		return index < other.index || (index == other.index && valueClass < other.valueClass);
+	}
+};
 
-// Возвращает последовательность вершин для изменения (в порядке)
-static VertexIDSeq chooseVerticesToModify(Graph &g) {
-	const VertixIDSet &accessible = g.accessibleVertices();
-	VertexIDSeq result;
-	// ... копируем доступные вершины в случайном порядке
-	for (VertixIDSet::const_iterator v = accessible.begin(); v != accessible.end(); v++) {
-		result.push_back(*v);
+// Множество пропускаемых изменений (sleep set), упорядоченное по Move::operator<
+typedef std::vector<Move> SleepSet;
+
+// Множества изменений, пропущенных при рассмотрении увиденных классов эквивалентности (по номерам в StateStore)
+typedef std::vector<SleepSet> HistorySleep;
+
+// Изменения из trace в порядке выполнения
+static std::vector<Solver::UpdateInfo> witnessOf(std::stack<Solver::UpdateInfo> trace) {
+	std::vector<Solver::UpdateInfo> witness;
+	for (/* empty */; !trace.empty(); trace.pop())
+		witness.push_back(trace.top());
+	std::reverse(witness.begin(), witness.end());
+	return witness;
+}
+
+TargetInfluence computeInfluence(const Graph &g, VertexID target) {
+	return computeInfluence(g, std::vector<VertexID>(1, target));
+}
+
+TargetInfluence computeInfluence(const Graph &g, const std::vector<VertexID> &targets) {
+	TargetInfluence influence;
+	influence.vertices.assign(g.vertices().size(), false);
+	influence.edges = EdgesBitset(g.equivalenceClass().size());
+
+	// Обход по исходящим ребрам, начиная с целей
+	std::vector<VertexIndex> to_visit;
+	for (std::vector<VertexID>::const_iterator t = targets.begin(); t != targets.end(); t++) {
+		if (g.hasVertex(*t))
+			to_visit.push_back(g.vertex(*t).index());
 	}
+	while (!to_visit.empty()) {
+		Edges out = g.outEdges(to_visit.back());
+		to_visit.pop_back();
+		for (Edges::const_iterator e = out.begin(); e != out.end(); e++) {
+			influence.edges.set(*e);
+			VertexIndex to = g.edgeTo(*e);
+			if (!influence.vertices[to]) {
+				influence.vertices[to] = true;
+				to_visit.push_back(to);
+			}
+		}
+	}
+	return influence;
+}
+
+VertexIDSeq chooseVerticesToModify(const Graph &g, const GraphState &state, const TargetInfluence &influence) {
+	VertexIDSeq result;
+	chooseVerticesToModify(g, state, influence, result);
 	return result;
 }
 
-// merge вычисляет (c1+c2) - removed.
-// c2 объединенное с removed дает битовое множество ребер, входящих в вершину.
-// Изменение значения в вершине приведет к тому, что ребра из c2 станут выполнены, а из removed - нет.
-static EquivalenceClass merge(const EquivalenceClass &c1, const EquivalenceClass &c2, const EdgesBitset &removed) {
-	EquivalenceClass res;
-	for (int k = 0; k < c1.size(); k++) {
-		res[k] = (c1[k] || c2[k]) && !removed[k];
+void chooseVerticesToModify(const Graph &g, const GraphState &state, const TargetInfluence &influence, VertexIDSeq &result) {
+	const AccessibleSet &accessible = state.accessible;
+	result.clear();
+	// ... копируем доступные вершины в случайном порядке
+	for (AccessibleSet::const_iterator v = accessible.begin(); v != accessible.end(); v++) {
+		if (influence.vertices[*v])
+			result.push_back(g.vertexAt(*v).id);
 	}
-	return res;
 }
 
 // Состояние перебора определяется двумя параметрами:
@@ -38,48 +86,157 @@ static EquivalenceClass merge(const EquivalenceClass &c1, const EquivalenceClass
 //
 // verticesToTry задает порядок изменяемых вершин (порядок определяется эвристикой)
 // valueClassIterator указывает на класс значений вершины, который нужно попробовать следующим
+// checkpoint - отметка журнала отмены, соответствующая состоянию графа при создании записи
+// sleep - изменения, которые в этом состоянии не рассматриваются: их результат уже получен в другом порядке
+// done - изменения, уже рассмотренные в этом состоянии
 struct SearchState {
 	VertexIDSeq verticesToTry;
 	ValueClasses::const_iterator valueClassIterator;
+	Graph::Checkpoint checkpoint;
+	SleepSet sleep;
+	SleepSet done;
+	size_t stateNumber; // Номер класса эквивалентности состояния в StateStore (в режиме bitstate - npos)
+	StateStore::Hash hash; // Его хэш
+	bool revisit; // Состояние уже перебиралось: рассматриваются только изменения из pending
+	SleepSet pending;
 };
 
+// Изменение a затрагивает ребра, которые ValueClass хранит для вершины a (edges_bitset | unsatisfied_edges),
+// то есть все входящие в нее ребра. Если среди них есть исходящее из other, то a может изменить доступность other.
+static bool affects(const Graph &g, const Move &a, VertexIndex other) {
+	Edges out = g.outEdges(other);
+	for (Edges::const_iterator e = out.begin(); e != out.end(); e++)
+		if (g.edgeTo(*e) == a.index)
+			return true;
+	return false;
+}
+
+// Изменения перестановочны, если они затрагивают разные ребра и ни одно не влияет на доступность вершины другого.
+// Тогда оба порядка выполнения возможны и приводят к одному классу эквивалентности.
+static bool independent(const Graph &g, const Move &a, const Move &b) {
+	return a.index != b.index && !affects(g, a, b.index) && !affects(g, b, a.index);
+}
 
-// Создает струкутру, которая определяет последовательность перебора 
-static SearchState makeSearchState(Graph &g, const std::set<VertexID> &visited) {
-	VertexIDSeq new_vertices_to_try = chooseVerticesToModify(g);
-	std::remove_if(new_vertices_to_try.begin(), new_vertices_to_try.end(),
-		[&visited](VertexID vid) { return contains(visited, vid); });
-	if(!new_vertices_to_try.empty()) {
-		const Vertex &v = g.vertex(new_vertices_to_try.at(0));
-		const ValueClasses &equiv_classes = v.equivalenceClasses();
-		return SearchState({ new_vertices_to_try, equiv_classes.begin() });
-	}
-	return SearchState({ new_vertices_to_try, ValueClasses::const_iterator() });
+// Пропускаемые изменения после выполнения move: пропускаемые и уже рассмотренные в текущем состоянии,
+// перестановочные с move (Godefroid, sleep sets)
+static void childSleepSet(const Graph &g, const SearchState &state, const Move &move, SleepSet &result) {
+	result.clear();
+	for (SleepSet::const_iterator m = state.sleep.begin(); m != state.sleep.end(); m++)
+		if (independent(g, *m, move))
+			result.push_back(*m);
+	const size_t sleeping = result.size();
+	for (SleepSet::const_iterator m = state.done.begin(); m != state.done.end(); m++)
+		if (independent(g, *m, move))
+			result.push_back(*m);
+	// state.sleep уже упорядочено
+	std::sort(result.begin() + sleeping, result.end());
+	std::inplace_merge(result.begin(), result.begin() + sleeping, result.end());
 }
 
-bool Solver::solver(Graph &g, VertexID target) {
-	History classes_history; // Какие классы эквивалентности мы уже видели
-	std::stack<SearchState> search_state; // Что еще осталось перебрать. Замена рекурсии
-	std::set<VertexID> visited_vertices; // Чтобы по многу раз не пытаться изменять значения одной вершины
+// Заполняет структуру, которая определяет последовательность перебора в текущем состоянии графа
+static void initSearchState(SearchState &state, Graph &g, const TargetInfluence &influence) {
+	chooseVerticesToModify(g, g.state(), influence, state.verticesToTry);
+	if (!state.verticesToTry.empty())
+		state.valueClassIterator = g.vertex(state.verticesToTry.front()).equivalenceClasses().begin();
+	else
+		state.valueClassIterator = ValueClasses::const_iterator();
+	state.checkpoint = g.checkpoint();
+	state.sleep.clear();
+	state.done.clear();
+	state.stateNumber = StateStore::npos;
+	state.hash = 0;
+	state.revisit = false;
+	state.pending.clear();
+}
 
+// Стек записей перебора. Записи не уничтожаются при возврате: при следующем спуске их контейнеры
+// используются снова, и перебор почти не обращается к куче. Адреса записей не меняются.
+class SearchStack {
+	std::deque<SearchState> frames_;
+	size_t size_;
+public:
+	SearchStack() : size_(0) {}
+	// Новая запись на вершине стека; ее поля нужно заполнить (initSearchState)
+	SearchState &push() {
+		if (size_ == frames_.size())
+			frames_.push_back(SearchState());
+		return frames_[size_++];
+	}
+	void pop() { size_--; }
+	SearchState &top() { return frames_[size_ - 1]; }
+	bool empty() const { return size_ == 0; }
+};
+
+bool Solver::solver(Graph &g, VertexID target) {
 	this->trace = std::stack<UpdateInfo>();
+	this->statesExpanded = 0;
+	this->historyBytes = 0;
+	this->stopReason = NOT_STOPPED;
+	this->historyLoadFactor = 0;
+	StatsScope stats_scope(*this, g);
+	SolverStats &counters = threadStats();
+
+	SolverCache::Result cached;
+	if (cache && cache->find(g, target, cached)) {
+		// Повторим сохраненные изменения: граф окажется в том же состоянии, что и после перебора
+		for (std::vector<UpdateInfo>::const_iterator w = cached.witness.begin(); w != cached.witness.end(); w++) {
+			ValueType old_value = g.setValue(w->vid, w->newValue);
+			trace.push({ w->vid, old_value, w->newValue });
+		}
+		AV_TRACE_EVENT(*this, AV_TRACE_RESULT, cached.accessible ? TraceEvent::SUCCESS : TraceEvent::FAILURE, trace.size());
+		outcome = cached.accessible ? ACCESSIBLE : INACCESSIBLE;
+		return cached.accessible;
+	}
+	const EquivalenceClass start = cache ? g.equivalenceClass() : EquivalenceClass();
+
+	const TargetInfluence influence = computeInfluence(g, target); // Классы эквивалентности храним только на влияющих ребрах
+	StateStore classes_history(influence.edges, options.bitstateBytes); // Какие классы эквивалентности мы уже видели
+	HistorySleep history_sleep;
+	SearchStack search_state; // Что еще осталось перебрать. Замена рекурсии
+	SearchBudget budget(options);
+
+	// Журнал отмены позволяет возвращаться к предыдущему состоянию без копирования графа
+	const bool external_checkpoints = g.state().undo.enabled;
 
-	classes_history.insert(g.equivalenceClass());
 	// Создадим корневую запись для организации перебора
-	search_state.push(makeSearchState(g, visited_vertices));
+	initSearchState(search_state.push(), g, influence);
+	search_state.top().hash = classes_history.hash(g.equivalenceClass());
+	search_state.top().stateNumber = classes_history.insert(g.equivalenceClass(), search_state.top().hash).first;
+	if (!classes_history.lossy())
+		history_sleep.push_back(SleepSet());
+	historyBytes = classes_history.bytes();
+	const Graph::Checkpoint root_mark = search_state.top().checkpoint;
+	// Рабочие значения шага перебора; память в них переиспользуется
+	SleepSet child_sleep, pending;
+	size_t sleep_bytes = 0;
 	
 	while (!search_state.empty()) {
-		std::cout << "\n\n" << g << std::endl;
+		AV_TRACE(AV_TRACE_VERBOSE, std::cout << "\n\n" << g << std::endl);
 
-		if (contains(g.accessibleVertices(), target)) {
-			std::cout << "SUCCESS! Chages made are (in reverse order):\n\n";
-			while (!trace.empty()) {
-				std::cout << trace.top().vid << " " << trace.top().old << " ==> " << trace.top().newValue << std::endl;
-				trace.pop();
-			}
+		if (g.hasVertex(target) && g.isAccessible(target)) {
+			AV_TRACE_EVENT(*this, AV_TRACE_RESULT, TraceEvent::SUCCESS, trace.size());
+			if (!external_checkpoints)
+				g.commit();
+			historyLoadFactor = classes_history.loadFactor();
+			if (cache)
+				cache->storeResult(g, start, target, SolverCache::Result({ true, witnessOf(trace) }));
+			outcome = ACCESSIBLE;
 			return true;
 		}
 
+		stopReason = budget.check(statesExpanded, historyBytes);
+		if (stopReason != NOT_STOPPED) {
+			// Ответа нет: возвращаем граф в исходное состояние, в кэш ничего не записываем
+			g.rollback(root_mark);
+			if (!external_checkpoints)
+				g.commit();
+			trace = std::stack<UpdateInfo>();
+			historyLoadFactor = classes_history.loadFactor();
+			AV_TRACE_EVENT(*this, AV_TRACE_RESULT, TraceEvent::FAILURE, 0);
+			outcome = UNKNOWN;
+			return false;
+		}
+
 		// Восстановим то место, где перебор был прерван "спуском вниз".
 		// Это ссылки, то есть код ниже изменяет значения, которые записаны в стеке search_state.
 		VertexIDSeq &to_modify = search_state.top().verticesToTry;
@@ -89,40 +246,110 @@ bool Solver::solver(Graph &g, VertexID target) {
 		// Найдем следующее изменение значения вершины, которое приводит к новому классу
 		while (!to_modify.empty() && !vertex_updated) {
 			VertexID vid = to_modify.front();
-			const ValueClasses &equiv_classes = g.vertex(vid).equivalenceClasses();
-			visited_vertices.insert(vid);
+			const Vertex &vertex = g.vertex(vid);
+			const ValueClasses &equiv_classes = vertex.equivalenceClasses();
 			for (/* empty */; ec != equiv_classes.end(); ec++) {
-				EquivalenceClass expected_outcome = merge(g.equivalenceClass(), ec->edges_bitset, ec->unsatisfied_edges);
-				std::cout << "Inspecting possible change of " << vid << " from " << g.vertex(vid).value() << " to " << ec->val << std::endl;
-				std::cout << "\tcurrent  : " << g.equivalenceClass()
+				const Move move = { vertex.index(), &*ec };
+				SearchState &current = search_state.top();
+				if (std::binary_search(current.sleep.begin(), current.sleep.end(), move))
+					continue; // Результат этого изменения уже получен в другом порядке
+				if (current.revisit && !std::binary_search(current.pending.begin(), current.pending.end(), move))
+					continue;
+				AV_TRACE_EVENT(*this, AV_TRACE_STEPS, TraceEvent::INSPECT, trace.size(), vid, g.vertex(vid).value(), ec->val);
+				AV_TRACE(AV_TRACE_VERBOSE, std::cout << "\tcurrent  : " << g.equivalenceClass()
 					<< "\n\tsatisfied: " << ec->edges_bitset
-					<< "\n\tmerged   : " << expected_outcome
-					<< std::endl;
-				if (!contains(classes_history, expected_outcome)) { // classes_history.find(expected_outcome) == classes_history.end()) {
-					// Если мы изменим значение vid на ec->val, то попадем в новый класс. Делаем!
-					ValueType old_value = g.setValue(vid, ec->val);
-					trace.push({ vid, old_value, ec->val }); // Запомним сделанную замену
-					classes_history.insert(g.equivalenceClass());
-					std::cout << "Changed " << vid << " from " << old_value << " to " << ec->val << std::endl;
-					// Добавим информацию о том, что нужно перебрать в новом состоянии
-					search_state.push(makeSearchState(g, visited_vertices));
-					vertex_updated = true;
-					break;
+					<< "\n\tmerged   : " << merge(g.equivalenceClass(), ec->edges_bitset, ec->unsatisfied_edges)
+					<< std::endl);
+				// Хэш и поиск нового класса - без его построения
+				StateStore::Hash child_hash;
+				if (!classes_history.childHash(g, g.equivalenceClass(), current.hash, vertex.index(), *ec, child_hash))
+					continue; // Изменение не меняет класс
+				child_sleep.clear();
+				if (partialOrderReduction)
+					childSleepSet(g, current, move, child_sleep);
+				pending.clear();
+				const std::pair<size_t, bool> seen = classes_history.insert(g.equivalenceClass(), *ec, child_hash);
+				const bool revisit = !seen.second;
+				if (revisit) {
+					counters.duplicateStates++;
+					// Класс уже рассматривался. Повторно нужно рассмотреть только изменения, которые тогда
+					// пропускались, а сейчас пропускать нельзя; дальше пропускаются лишь общие.
+					// В режиме bitstate пропущенные изменения не хранятся, и класс повторно не рассматривается.
+					if (!classes_history.lossy())
+						std::set_difference(history_sleep[seen.first].begin(), history_sleep[seen.first].end(),
+							child_sleep.begin(), child_sleep.end(), std::back_inserter(pending));
+					if (pending.empty()) {
+						if (partialOrderReduction)
+							current.done.push_back(move);
+						continue;
+					}
+					SleepSet &seen_sleep = history_sleep[seen.first];
+					seen_sleep.erase(std::remove_if(seen_sleep.begin(), seen_sleep.end(), [&child_sleep](const Move &m) {
+						return !std::binary_search(child_sleep.begin(), child_sleep.end(), m);
+					}), seen_sleep.end());
+				}
+				else {
+					if (!classes_history.lossy()) {
+						history_sleep.push_back(child_sleep);
+						sleep_bytes += child_sleep.size() * sizeof(Move);
+					}
+					historyBytes = classes_history.bytes() + sleep_bytes;
+					statesExpanded++;
+					counters.countBranch(vertex.index());
 				}
+				// Если мы изменим значение vid на ec->val, то попадем в новый класс. Делаем!
+				ValueType old_value = g.setValue(vid, ec->val);
+				trace.push({ vid, old_value, ec->val }); // Запомним сделанную замену
+				counters.maxDepth = std::max(counters.maxDepth, trace.size());
+				AV_TRACE_EVENT(*this, AV_TRACE_STEPS, TraceEvent::CHANGE, trace.size(), vid, old_value, ec->val);
+				if (partialOrderReduction)
+					current.done.push_back(move);
+				ec++; // После возврата продолжим со следующего класса
+				// Добавим информацию о том, что нужно перебрать в новом состоянии
+				SearchState &next = search_state.push();
+				initSearchState(next, g, influence);
+				next.sleep.swap(child_sleep);
+				next.stateNumber = seen.first;
+				next.hash = child_hash;
+				next.revisit = revisit;
+				next.pending.swap(pending);
+				vertex_updated = true;
+				break;
 			}
 			if (!vertex_updated) { // Не удалось найти значение для вершины vid
 				to_modify.pop_front(); // переходим к следующей вершине
 				if (!to_modify.empty()) // если вершина есть, то устанавливаем итератор на ее первый класс значений 
-					ec = g.vertices().at(to_modify.front()).equivalenceClasses().begin();
+					ec = g.vertex(to_modify.front()).equivalenceClasses().begin();
 			}
 		}
 		// Перебрали все вершины, поднимаемся на один уровень "рекурсии" вверх
 		if (to_modify.empty()) {
+			Graph::Checkpoint mark = search_state.top().checkpoint;
 			search_state.pop();
+			// Вернем граф в состояние, в котором была создана предыдущая запись (или в исходное)
+			g.rollback(search_state.empty() ? mark : search_state.top().checkpoint);
 			if(!trace.empty())
 				trace.pop();
+			AV_TRACE_EVENT(*this, AV_TRACE_STEPS, TraceEvent::BACKTRACK, trace.size());
 		}
 	}
-	std::cout << "No access to " << target << "\n" << std::endl;
+	if (!external_checkpoints)
+		g.commit();
+	historyLoadFactor = classes_history.loadFactor();
+	AV_TRACE_EVENT(*this, AV_TRACE_RESULT, TraceEvent::FAILURE, 0);
+	// В режиме bitstate часть классов могла быть пропущена из-за совпадения хэшей: ответа нет
+	if (classes_history.lossy()) {
+		outcome = UNKNOWN;
+		return false;
+	}
+	if (cache && g.hasVertex(target)) {
+		cache->storeResult(g, start, target, SolverCache::Result({ false, std::vector<UpdateInfo>() }));
+		std::vector<EquivalenceClass> explored;
+		explored.reserve(classes_history.size());
+		for (size_t k = 0; k < classes_history.size(); k++)
+			explored.push_back(classes_history.state(k));
+		cache->storeExplored(g, start, influence.edges, explored);
+	}
+	outcome = INACCESSIBLE;
 	return false;
 }
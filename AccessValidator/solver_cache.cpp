@@ -0,0 +1,190 @@
+﻿#include <fstream>
+#include <cstring>
+#include "AccessValidator.h"
+#include "search.h"
+#include "solver_cache.h"
+
+bool SolverCache::find(const Graph &g, VertexID target, Result &result) {
+	Key key = { g.fingerprint(), g.equivalenceClass() };
+	std::unordered_map<Key, Entry, KeyHash>::iterator entry = entries_.find(key);
+	if (entry == entries_.end() || !g.hasVertex(target)) {
+		misses_++;
+		return false;
+	}
+	std::unordered_map<VertexID, Result>::const_iterator r = entry->second.results.find(target);
+	if (r != entry->second.results.end()) {
+		result = r->second;
+		hits_++;
+		return true;
+	}
+
+	// Недоступность цели следует из завершенного перебора, если он рассматривал все влияющие на нее ребра
+	const std::vector<EquivalenceClass> &explored = entry->second.explored;
+	if (!explored.empty() && entry->second.scope.size() == g.edgesCount()
+		&& computeInfluence(g, target).edges.isSubsetOf(entry->second.scope)) {
+		const Vertex &t = g.vertex(target);
+		bool accessible = false;
+		for (size_t k = 0; k < explored.size() && !accessible; k++)
+			accessible = t.checkAccessibility(explored[k]);
+		if (!accessible) {
+			result.accessible = false;
+			result.witness.clear();
+			entry->second.results[target] = result;
+			hits_++;
+			return true;
+		}
+	}
+	misses_++;
+	return false;
+}
+
+void SolverCache::storeResult(const Graph &g, const EquivalenceClass &start, VertexID target, const Result &result) {
+	Key key = { g.fingerprint(), start };
+	entries_[key].results[target] = result;
+}
+
+void SolverCache::storeExplored(const Graph &g, const EquivalenceClass &start, const EdgesBitset &scope,
+		std::vector<EquivalenceClass> &explored) {
+	Key key = { g.fingerprint(), start };
+	Entry &entry = entries_[key];
+	// Сохраняется перебор, рассматривавший не меньше ребер, чем прежний
+	if (!entry.explored.empty() && !entry.scope.isSubsetOf(scope))
+		return;
+	entry.scope = scope;
+	entry.explored.swap(explored);
+}
+
+//
+// Файл кэша: заголовок "AVCACHE", версия, число записей, затем записи подряд.
+// Битовые множества записываются как размер в битах и слова.
+//
+
+static const char cache_file_magic[8] = { 'A', 'V', 'C', 'A', 'C', 'H', 'E', 0 };
+static const uint32_t cache_file_version = 1;
+
+template<class T>
+static void put(std::ofstream &os, const T &value) {
+	os.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<class T>
+static void get(std::ifstream &is, T &value) {
+	if (!is.read(reinterpret_cast<char*>(&value), sizeof(value)))
+		throw BadCacheFile("cache file is truncated");
+}
+
+static void putSet(std::ofstream &os, const EdgeSet &s) {
+	put(os, static_cast<uint64_t>(s.size()));
+	if (!s.words().empty())
+		os.write(reinterpret_cast<const char*>(s.words().data()), s.words().size() * sizeof(EdgeSet::Word));
+}
+
+static void getSet(std::ifstream &is, EdgeSet &s, uint64_t max_size) {
+	uint64_t size;
+	get(is, size);
+	if (size > max_size)
+		throw BadCacheFile("cache file is corrupted");
+	std::vector<EdgeSet::Word> words(EdgeSet::wordsFor(static_cast<size_t>(size)));
+	if (!words.empty() && !is.read(reinterpret_cast<char*>(words.data()), words.size() * sizeof(EdgeSet::Word)))
+		throw BadCacheFile("cache file is truncated");
+	s = EdgeSet(static_cast<size_t>(size), words.data());
+}
+
+void SolverCache::save(const std::string &path) const {
+	std::ofstream os(path.c_str(), std::ios::binary | std::ios::trunc);
+	if (!os)
+		throw BadCacheFile("cannot create " + path);
+	os.write(cache_file_magic, sizeof(cache_file_magic));
+	put(os, cache_file_version);
+	put(os, static_cast<uint64_t>(entries_.size()));
+	for (std::unordered_map<Key, Entry, KeyHash>::const_iterator e = entries_.begin(); e != entries_.end(); e++) {
+		put(os, e->first.fingerprint);
+		putSet(os, e->first.start);
+		put(os, static_cast<uint64_t>(e->second.results.size()));
+		for (std::unordered_map<VertexID, Result>::const_iterator r = e->second.results.begin(); r != e->second.results.end(); r++) {
+			put(os, static_cast<uint32_t>(r->first));
+			put(os, static_cast<uint32_t>(r->second.accessible));
+			put(os, static_cast<uint64_t>(r->second.witness.size()));
+			for (std::vector<Solver::UpdateInfo>::const_iterator w = r->second.witness.begin(); w != r->second.witness.end(); w++) {
+				put(os, static_cast<uint32_t>(w->vid));
+				put(os, w->old);
+				put(os, w->newValue);
+			}
+		}
+		putSet(os, e->second.scope);
+		put(os, static_cast<uint64_t>(e->second.explored.size()));
+		for (std::vector<EquivalenceClass>::const_iterator c = e->second.explored.begin(); c != e->second.explored.end(); c++)
+			putSet(os, *c);
+	}
+	if (!os)
+		throw BadCacheFile("cannot write " + path);
+}
+
+void SolverCache::load(const std::string &path) {
+	std::ifstream is(path.c_str(), std::ios::binary);
+	if (!is)
+		throw BadCacheFile("cannot open " + path);
+	// Размеры проверяются по длине файла, чтобы поврежденный файл не приводил к огромным выделениям памяти
+	is.seekg(0, std::ios::end);
+	const uint64_t file_size = static_cast<uint64_t>(is.tellg());
+	is.seekg(0, std::ios::beg);
+	const uint64_t max_bits = file_size * 8;
+
+	char magic[sizeof(cache_file_magic)];
+	uint32_t version;
+	if (!is.read(magic, sizeof(magic)) || std::memcmp(magic, cache_file_magic, sizeof(magic)) != 0)
+		throw BadCacheFile("not a cache file");
+	get(is, version);
+	if (version != cache_file_version)
+		throw BadCacheFile("unsupported cache file version");
+
+	uint64_t entries_count;
+	get(is, entries_count);
+	for (uint64_t k = 0; k < entries_count; k++) {
+		Key key;
+		get(is, key.fingerprint);
+		getSet(is, key.start, max_bits);
+		Entry &entry = entries_[key];
+
+		uint64_t results_count;
+		get(is, results_count);
+		if (results_count > file_size)
+			throw BadCacheFile("cache file is corrupted");
+		for (uint64_t r = 0; r < results_count; r++) {
+			uint32_t target, accessible;
+			uint64_t witness_size;
+			get(is, target);
+			get(is, accessible);
+			get(is, witness_size);
+			if (witness_size > file_size)
+				throw BadCacheFile("cache file is corrupted");
+			Result &result = entry.results[target];
+			result.accessible = accessible != 0;
+			result.witness.resize(static_cast<size_t>(witness_size));
+			for (size_t w = 0; w < result.witness.size(); w++) {
+				uint32_t vid;
+				get(is, vid);
+				result.witness[w].vid = vid;
+				get(is, result.witness[w].old);
+				get(is, result.witness[w].newValue);
+			}
+		}
+
+		EdgesBitset scope;
+		uint64_t explored_count;
+		getSet(is, scope, max_bits);
+		get(is, explored_count);
+		if (explored_count > file_size)
+			throw BadCacheFile("cache file is corrupted");
+		std::vector<EquivalenceClass> explored(static_cast<size_t>(explored_count));
+		for (size_t c = 0; c < explored.size(); c++) {
+			getSet(is, explored[c], max_bits);
+			if (explored[c].size() != scope.size())
+				throw BadCacheFile("cache file is corrupted");
+		}
+		if (!explored.empty() && (entry.explored.empty() || (entry.scope.size() == scope.size() && entry.scope.isSubsetOf(scope)))) {
+			entry.scope = scope;
+			entry.explored.swap(explored);
+		}
+	}
+}
@@ -0,0 +1,66 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include "AccessValidator.h"
+
+// Ошибка чтения или записи файла кэша
+class BadCacheFile : public Error {
+public:
+	std::string reason;
+	explicit BadCacheFile(const std::string &r) : reason(r) {}
+};
+
+// Кэш результатов перебора. Ключ - отпечаток графа (Graph::fingerprint()) и исходный класс эквивалентности,
+// то есть множество выполненных ребер, с которого начинается перебор: от значений вершин результат
+// зависит только через него.
+//
+// Для каждого ключа хранятся:
+// - доказанные результаты по целям вместе с последовательностью изменений, открывающей доступ;
+// - множество состояний последнего полностью завершенного перебора, ограниченных на ребра scope.
+//   Если все влияющие на цель ребра лежат в scope и ни в одном из этих состояний цель не доступна,
+//   то доступа нет, и перебор для нее не нужен.
+class SolverCache {
+public:
+	struct Result {
+		bool accessible;
+		std::vector<Solver::UpdateInfo> witness; // Изменения в порядке выполнения
+	};
+
+	SolverCache() : hits_(0), misses_(0) {}
+
+	// Ищет результат для цели при текущем состоянии графа
+	bool find(const Graph &g, VertexID target, Result &result);
+	void storeResult(const Graph &g, const EquivalenceClass &start, VertexID target, const Result &result);
+	// Состояния завершенного перебора, начатого из start; каждое ограничено на ребра scope
+	void storeExplored(const Graph &g, const EquivalenceClass &start, const EdgesBitset &scope,
+		std::vector<EquivalenceClass> &explored);
+
+	size_t size() const { return entries_.size(); }
+	size_t hits() const { return hits_; }
+	size_t misses() const { return misses_; }
+	void clear() { entries_.clear(); hits_ = misses_ = 0; }
+
+	// Сохранение на диск и загрузка; load добавляет записи к уже имеющимся
+	void save(const std::string &path) const;
+	void load(const std::string &path);
+
+private:
+	struct Key {
+		uint64_t fingerprint;
+		EquivalenceClass start;
+		bool operator==(const Key &other) const { return fingerprint == other.fingerprint && start == other.start; }
+	};
+	struct KeyHash {
+		size_t operator()(const Key &k) const { return static_cast<size_t>(EdgeSet::mix(k.fingerprint ^ k.start.hash())); }
+	};
+	struct Entry {
+		std::unordered_map<VertexID, Result> results;
+		EdgesBitset scope;
+		std::vector<EquivalenceClass> explored;
+	};
+	std::unordered_map<Key, Entry, KeyHash> entries_;
+	size_t hits_, misses_;
+};
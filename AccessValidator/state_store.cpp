@@ -0,0 +1,151 @@
+﻿#include <algorithm>
+#include "state_store.h"
+
+const size_t StateStore::npos;
+
+// Слово w множества; недостающие слова - нулевые (см. EdgeSet о множествах разного размера)
+static EdgeSet::Word wordAt(const EdgeSet &s, size_t w) {
+	return w < s.words().size() ? s.words()[w] : 0;
+}
+
+static bool bitAt(const EdgeSet &s, size_t k) {
+	return k < s.size() && s.test(k);
+}
+
+// Слова состояния, ограниченного на влияющие ребра
+struct PlainWords {
+	const EquivalenceClass &state;
+	const EdgesBitset &mask;
+	EdgeSet::Word operator()(size_t w) const { return wordAt(state, w) & wordAt(mask, w); }
+};
+
+// Слова результата merge(state, c.edges_bitset, c.unsatisfied_edges), ограниченного на влияющие ребра
+struct MergedWords {
+	const EquivalenceClass &state;
+	const ValueClass &c;
+	const EdgesBitset &mask;
+	EdgeSet::Word operator()(size_t w) const {
+		return (wordAt(state, w) | wordAt(c.edges_bitset, w)) & ~wordAt(c.unsatisfied_edges, w) & wordAt(mask, w);
+	}
+};
+
+StateStore::StateStore(const EdgesBitset &edges, size_t bitstate_bytes)
+	: mask_(edges), keys_(edges.size(), 0), stride_(edges.words().size()), count_(0), bits_set_(0) {
+	for (size_t e = 0; e < edges.size(); e++)
+		if (edges.test(e))
+			keys_[e] = EdgeSet::mix(0xA5A5A5A5ULL + e);
+	if (bitstate_bytes)
+		bits_.assign(std::max<size_t>(1, bitstate_bytes / sizeof(EdgeSet::Word)), 0);
+	else
+		slots_.assign(16, Slot({ 0, npos }));
+}
+
+StateStore::Hash StateStore::hash(const EquivalenceClass &state) const {
+	Hash h = 0;
+	for (size_t e = 0; e < keys_.size(); e++)
+		if (keys_[e] && bitAt(state, e))
+			h ^= keys_[e];
+	return h;
+}
+
+bool StateStore::childHash(const Graph &g, const EquivalenceClass &state, Hash h, VertexIndex v, const ValueClass &c,
+		Hash &child) const {
+	bool changed = false;
+	Edges in = g.inEdges(v);
+	for (Edges::const_iterator e = in.begin(); e != in.end(); e++) {
+		if (!keys_[*e])
+			continue;
+		const bool before = state.test(*e);
+		const bool after = bitAt(c.edges_bitset, *e) || (before && !bitAt(c.unsatisfied_edges, *e));
+		if (before != after) {
+			h ^= keys_[*e];
+			changed = true;
+		}
+	}
+	child = h;
+	return changed;
+}
+
+std::pair<size_t, bool> StateStore::insert(const EquivalenceClass &state, Hash h) {
+	return probe(h, PlainWords({ state, mask_ }));
+}
+
+std::pair<size_t, bool> StateStore::insert(const EquivalenceClass &state, const ValueClass &c, Hash h) {
+	return probe(h, MergedWords({ state, c, mask_ }));
+}
+
+template<class Words> std::pair<size_t, bool> StateStore::probe(Hash h, const Words &words) {
+	if (lossy()) {
+		// Два бита по независимым частям хэша; состояние считается встреченным, если установлены оба
+		const size_t bits = bits_.size() * EdgeSet::word_bits;
+		const size_t positions[] = { static_cast<size_t>(h % bits), static_cast<size_t>(EdgeSet::mix(h) % bits) };
+		bool seen = true;
+		for (size_t k = 0; k < 2; k++) {
+			EdgeSet::Word &word = bits_[positions[k] / EdgeSet::word_bits];
+			const EdgeSet::Word bit = EdgeSet::Word(1) << (positions[k] % EdgeSet::word_bits);
+			if (word & bit)
+				continue;
+			word |= bit;
+			bits_set_++;
+			seen = false;
+		}
+		count_ += seen ? 0 : 1;
+		return std::make_pair(npos, !seen);
+	}
+
+	if (2 * (count_ + 1) > slots_.size())
+		grow();
+	const size_t mask = slots_.size() - 1;
+	for (size_t i = static_cast<size_t>(h) & mask; ; i = (i + 1) & mask) {
+		Slot &slot = slots_[i];
+		if (slot.state == npos) {
+			for (size_t w = 0; w < stride_; w++)
+				states_.push_back(words(w));
+			slot.hash = h;
+			slot.state = count_;
+			return std::make_pair(count_++, true);
+		}
+		if (slot.hash != h)
+			continue;
+		const EdgeSet::Word *stored = &states_[slot.state * stride_];
+		size_t w = 0;
+		while (w < stride_ && stored[w] == words(w))
+			w++;
+		if (w == stride_)
+			return std::make_pair(slot.state, false);
+	}
+}
+
+// Удваивает таблицу; места состояний вычисляются по сохраненным хэшам
+void StateStore::grow() {
+	std::vector<Slot> slots(2 * slots_.size(), Slot({ 0, npos }));
+	const size_t mask = slots.size() - 1;
+	for (std::vector<Slot>::const_iterator s = slots_.begin(); s != slots_.end(); s++) {
+		if (s->state == npos)
+			continue;
+		size_t i = static_cast<size_t>(s->hash) & mask;
+		while (slots[i].state != npos)
+			i = (i + 1) & mask;
+		slots[i] = *s;
+	}
+	slots_.swap(slots);
+}
+
+EquivalenceClass StateStore::state(size_t k) const {
+	EquivalenceClass result(mask_.size());
+	for (size_t e = 0; e < mask_.size(); e++)
+		if ((states_[k * stride_ + e / EdgeSet::word_bits] >> (e % EdgeSet::word_bits)) & 1)
+			result.set(e);
+	return result;
+}
+
+size_t StateStore::bytes() const {
+	return states_.capacity() * sizeof(EdgeSet::Word) + slots_.capacity() * sizeof(Slot)
+		+ bits_.capacity() * sizeof(EdgeSet::Word) + keys_.capacity() * sizeof(Hash);
+}
+
+double StateStore::loadFactor() const {
+	if (lossy())
+		return static_cast<double>(bits_set_) / (bits_.size() * EdgeSet::word_bits);
+	return static_cast<double>(count_) / slots_.size();
+}
@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include "AccessValidator.h"
+
+// Множество просмотренных состояний перебора - классов эквивалентности, ограниченных на влияющие ребра.
+//
+// Состояния хранятся упакованными подряд в одном массиве слов, а таблица с открытой адресацией
+// (линейное пробирование) хранит их номера и хэши, так что добавление состояния не выделяет память под узел.
+// Хэш - Zobrist: XOR случайных ключей выполненных влияющих ребер. Изменение значения вершины
+// переключает только входящие в нее ребра, поэтому хэш нового состояния получается из хэша текущего
+// (childHash), а поиск сравнивает сохраненные слова с результатом merge() пословно, не строя его.
+//
+// В режиме bitstate (Holzmann) состояния не хранятся: каждому соответствуют два бита в массиве заданного
+// размера. Память ограничена заранее, но разные состояния могут совпасть, и тогда часть пространства
+// состояний пропускается: найденный доступ достоверен, а его отсутствие - нет.
+class StateStore {
+public:
+	typedef uint64_t Hash;
+	static const size_t npos = static_cast<size_t>(-1);
+
+	// edges - влияющие ребра; bitstate_bytes = 0 - точное хранение
+	explicit StateStore(const EdgesBitset &edges, size_t bitstate_bytes = 0);
+
+	Hash hash(const EquivalenceClass &state) const;
+	// Хэш состояния, в которое переходит state (с хэшем h) при изменении вершины v на класс c.
+	// Возвращает false, если изменение не переключает ни одного влияющего ребра, то есть состояние прежнее.
+	bool childHash(const Graph &g, const EquivalenceClass &state, Hash h, VertexIndex v, const ValueClass &c,
+		Hash &child) const;
+
+	// Добавляет состояние state с хэшем h. Возвращает номер состояния (в режиме bitstate - npos)
+	// и true, если его еще не было.
+	std::pair<size_t, bool> insert(const EquivalenceClass &state, Hash h);
+	// То же для merge(state, c.edges_bitset, c.unsatisfied_edges) без построения этого состояния
+	std::pair<size_t, bool> insert(const EquivalenceClass &state, const ValueClass &c, Hash h);
+
+	EquivalenceClass state(size_t k) const; // Сохраненное состояние с номером k (кроме режима bitstate)
+	size_t size() const { return count_; } // Число добавленных состояний (в режиме bitstate - приблизительно)
+	bool lossy() const { return !bits_.empty(); }
+	size_t bytes() const; // Занимаемая память
+	// Заполненность таблицы; в режиме bitstate - доля установленных битов
+	double loadFactor() const;
+
+private:
+	struct Slot {
+		Hash hash;
+		size_t state; // Номер состояния; npos - свободное место
+	};
+
+	EdgesBitset mask_; // Влияющие ребра
+	std::vector<Hash> keys_; // Ключи Zobrist по номерам ребер; у невлияющих ребер - 0
+	size_t stride_; // Слов на одно состояние
+	std::vector<EdgeSet::Word> states_; // Состояния подряд по stride_ слов
+	std::vector<Slot> slots_; // Размер - степень двойки
+	size_t count_;
+	std::vector<EdgeSet::Word> bits_; // Режим bitstate
+	size_t bits_set_;
+
+	template<class Words> std::pair<size_t, bool> probe(Hash h, const Words &words);
+	void grow();
+};
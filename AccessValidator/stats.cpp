@@ -0,0 +1,54 @@
+﻿#include <algorithm>
+#include "AccessValidator.h"
+
+void SolverStats::clear() {
+	statesExpanded = 0;
+	duplicateStates = 0;
+	maxDepth = 0;
+	setValueCalls = 0;
+	historyPeakBytes = 0;
+	buildSeconds = 0;
+	classesSeconds = 0;
+	searchSeconds = 0;
+	branching.clear();
+}
+
+SolverStats& SolverStats::operator+=(const SolverStats &other) {
+	statesExpanded += other.statesExpanded;
+	duplicateStates += other.duplicateStates;
+	maxDepth = std::max(maxDepth, other.maxDepth);
+	setValueCalls += other.setValueCalls;
+	historyPeakBytes = std::max(historyPeakBytes, other.historyPeakBytes);
+	buildSeconds += other.buildSeconds;
+	classesSeconds += other.classesSeconds;
+	searchSeconds += other.searchSeconds;
+	if (branching.size() < other.branching.size())
+		branching.resize(other.branching.size(), 0);
+	for (size_t v = 0; v < other.branching.size(); v++)
+		branching[v] += other.branching[v];
+	return *this;
+}
+
+void SolverStats::writeJson(std::ostream &os, const Graph &g) const {
+	std::vector<std::pair<size_t, VertexIndex> > branches;
+	for (VertexIndex v = 0; v < branching.size() && v < g.vertices().size(); v++)
+		if (branching[v])
+			branches.push_back(std::make_pair(branching[v], v));
+	std::sort(branches.begin(), branches.end(), [](const std::pair<size_t, VertexIndex> &a, const std::pair<size_t, VertexIndex> &b) {
+		return a.first > b.first || (a.first == b.first && a.second < b.second);
+	});
+
+	os << "{\"states_expanded\": " << statesExpanded << ", \"duplicate_states\": " << duplicateStates
+		<< ", \"max_depth\": " << maxDepth << ", \"set_value_calls\": " << setValueCalls
+		<< ", \"history_peak_bytes\": " << historyPeakBytes
+		<< ", \"seconds\": {\"build\": " << buildSeconds << ", \"classes\": " << classesSeconds
+		<< ", \"search\": " << searchSeconds << "}, \"branching\": {";
+	for (size_t k = 0; k < branches.size(); k++)
+		os << (k ? ", " : "") << "\"" << g.vertexAt(branches[k].second).id << "\": " << branches[k].first;
+	os << "}}";
+}
+
+SolverStats& threadStats() {
+	static thread_local SolverStats stats;
+	return stats;
+}
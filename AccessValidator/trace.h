@@ -0,0 +1,81 @@
+﻿#pragma once
+
+#include <vector>
+#include <iostream>
+#include "AccessValidator.h"
+
+// Трассировка перебора.
+// Уровень задается при компиляции макросом AV_TRACE_LEVEL (make TRACE=2).
+// По умолчанию трассировка выключена, и вызовы AV_TRACE не порождают никакого кода.
+#define AV_TRACE_NONE 0
+#define AV_TRACE_RESULT 1 // Итог перебора
+#define AV_TRACE_STEPS 2 // События каждого шага перебора
+#define AV_TRACE_VERBOSE 3 // Дополнительно печать состояния графа в std::cout
+
+#ifndef AV_TRACE_LEVEL
+#define AV_TRACE_LEVEL AV_TRACE_NONE
+#endif
+
+#if AV_TRACE_LEVEL > AV_TRACE_NONE
+#define AV_TRACE(level, statement) do { if ((level) <= AV_TRACE_LEVEL) { statement; } } while (0)
+#else
+#define AV_TRACE(level, statement) do { } while (0)
+#endif
+
+// Передача события приемнику, заданному в Solver::traceSink. Без трассировки solver только отмечается
+// использованным: параметр, нужный лишь для трассировки, не вызывает предупреждения -Wunused-parameter.
+#if AV_TRACE_LEVEL > AV_TRACE_NONE
+#define AV_TRACE_EVENT(solver, level, ...) \
+	AV_TRACE(level, if ((solver).traceSink) (solver).traceSink(TraceEvent(__VA_ARGS__)))
+#else
+#define AV_TRACE_EVENT(solver, level, ...) do { (void)(solver); } while (0)
+#endif
+
+// Событие перебора
+struct TraceEvent {
+	enum Kind {
+		INSPECT, // Рассматривается изменение значения вершины
+		CHANGE, // Значение вершины изменено, получен новый класс эквивалентности
+		BACKTRACK, // Возврат на уровень вверх
+		SUCCESS, // Цель доступна
+		FAILURE // Перебор завершен, доступа нет
+	} kind;
+	size_t depth; // Глубина перебора
+	VertexID vid;
+	ValueType old_value;
+	ValueType new_value;
+
+	TraceEvent(Kind k, size_t d, VertexID v = 0, ValueType old_val = 0, ValueType new_val = 0)
+		: kind(k), depth(d), vid(v), old_value(old_val), new_value(new_val) {}
+	TraceEvent() : kind(INSPECT), depth(0), vid(0), old_value(0), new_value(0) {}
+};
+
+inline std::ostream& operator<<(std::ostream &os, const TraceEvent &e) {
+	static const char *names[] = { "inspect", "change", "backtrack", "success", "failure" };
+	os << names[e.kind] << " depth=" << e.depth;
+	if (e.kind == TraceEvent::INSPECT || e.kind == TraceEvent::CHANGE)
+		os << " vertex=" << e.vid << " " << e.old_value << " ==> " << e.new_value;
+	return os;
+}
+
+// Кольцевой буфер последних событий. Может использоваться как приемник: solver.traceSink = std::ref(ring).
+class TraceRing {
+	std::vector<TraceEvent> events_;
+	size_t next_; // Куда будет записано следующее событие
+	size_t count_; // Сколько событий записано всего
+public:
+	explicit TraceRing(size_t capacity) : events_(capacity), next_(0), count_(0) {}
+
+	void operator()(const TraceEvent &e) {
+		if (events_.empty())
+			return;
+		events_[next_] = e;
+		next_ = (next_ + 1) % events_.size();
+		count_++;
+	}
+	size_t size() const { return std::min(count_, events_.size()); } // Число сохраненных событий
+	size_t total() const { return count_; } // Число событий с начала записи, включая вытесненные
+	// k = 0 - самое старое из сохраненных событий
+	const TraceEvent& operator[](size_t k) const { return events_[(next_ + events_.size() - size() + k) % events_.size()]; }
+	void clear() { next_ = 0; count_ = 0; }
+};